@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ADLER32_HAS_SSSE3 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Adler-32 из трейлера zlib (RFC 1950): s1 - сумма байт плюс 1, s2 - сумма всех промежуточных s1,
+// обе по модулю 65521. Остаток берётся не на каждом байте, а раз в ADLER32_NMAX байт - самый длинный
+// кусок, на котором s2 ещё не переполняет 32 бита. На x86-64 с SSSE3 кусок обрабатывается по 32 байта:
+// сумма байт через psadbw, а сумма с весами 32..1 (вклад каждого байта в s2) через pmaddubsw.
+
+constexpr uint32_t ADLER32_BASE = 65521;
+constexpr size_t ADLER32_NMAX = 5552;
+
+inline uint32_t adler32_scalar(uint32_t adler, const uint8_t *data, size_t len)
+{
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+
+    while (len > 0)
+    {
+        size_t count = len < ADLER32_NMAX ? len : ADLER32_NMAX;
+        len -= count;
+
+        while (count >= 8)
+        {
+            for (uint8_t i = 0; i < 8; ++i)
+            {
+                s1 += data[i];
+                s2 += s1;
+            }
+            data += 8;
+            count -= 8;
+        }
+        while (count-- > 0)
+        {
+            s1 += *data++;
+            s2 += s1;
+        }
+
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    return (s2 << 16) | s1;
+}
+
+#ifdef ADLER32_HAS_SSSE3
+
+// Сумма четырёх 32-битных элементов
+__attribute__((target("ssse3"))) inline uint32_t adler32_hsum(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+}
+
+// Обрабатывает len байт, len кратно 32. На куске из n байт s2 растёт на n * s1 + sum((n - i) * data[i]):
+// вклад каждого 32-байтового шага - 32 * (сумма байт всех прошлых шагов) плюс его байты с весами 32..1
+__attribute__((target("ssse3"))) inline uint32_t adler32_ssse3(uint32_t adler, const uint8_t *data, size_t len)
+{
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i weights_high = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i weights_low = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+
+    while (len > 0)
+    {
+        size_t count = len < ADLER32_NMAX ? len : ADLER32_NMAX / 32 * 32;
+        len -= count;
+
+        __m128i sum = zero;       // сумма байт куска
+        __m128i prev_sums = zero; // суммы байт до каждого шага
+        __m128i weighted = zero;  // байты шагов с весами 32..1
+
+        for (size_t i = 0; i < count; i += 32)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16));
+
+            prev_sums = _mm_add_epi32(prev_sums, sum);
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_maddubs_epi16(a, weights_high), ones));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_maddubs_epi16(b, weights_low), ones));
+        }
+
+        s2 += s1 * static_cast<uint32_t>(count) + 32 * adler32_hsum(prev_sums) + adler32_hsum(weighted);
+        s1 += adler32_hsum(sum);
+        data += count;
+
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    return (s2 << 16) | s1;
+}
+
+inline bool has_ssse3()
+{
+    static const bool supported = []
+    {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+        return (ecx & bit_SSSE3) != 0;
+    }();
+    return supported;
+}
+
+#endif
+
+// Adler-32 данных, дописанных к уже посчитанным с результатом adler; для начала adler = 1 (как adler32 в zlib)
+inline uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t len)
+{
+#ifdef ADLER32_HAS_SSSE3
+    if (len >= 64 && has_ssse3())
+    {
+        size_t chunk = len & ~size_t(31);
+        adler = adler32_ssse3(adler, data, chunk);
+        data += chunk;
+        len -= chunk;
+    }
+#endif
+
+    return adler32_scalar(adler, data, len);
+}
+
+inline uint32_t adler32_update(uint32_t adler, const char *data, size_t len)
+{
+    return adler32_update(adler, reinterpret_cast<const uint8_t *>(data), len);
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "input_source.h"
+
+// Чтение битового потока DEFLATE: биты младшими вперёд подгружаются в 64-битный аккумулятор
+// сразу по 8 байт, коды Хаффмана снимаются через peek/consume. Байты берутся прямо из готового
+// буфера или отображённого файла, а из канала - кусками по CHUNK_SIZE, так что весь сжатый файл
+// в памяти не нужен.
+class BitReader
+{
+   private:
+    static constexpr size_t CHUNK_SIZE = 1 << 16;
+
+    InputSource *source;          // nullptr, если все данные уже в памяти
+    std::vector<uint8_t> buffer;  // куски, прочитанные из source
+
+    const uint8_t *data;
+    size_t size;
+    size_t pos;              // следующий ещё не загруженный в аккумулятор байт
+    uint64_t buffer_offset;  // сколько байт потока было до data[0]
+
+    uint64_t bit_buf;
+    uint8_t bit_count;
+    size_t overrun;  // сколько нулевых байт подставлено за концом данных
+
+    // Сдвигает непрочитанный хвост в начало буфера и дочитывает поток; false, если поток кончился
+    bool fill_buffer()
+    {
+        if (source == nullptr)
+            return false;
+
+        size_t tail = size - pos;
+        buffer_offset += pos;
+        memmove(buffer.data(), buffer.data() + pos, tail);
+
+        size = tail + source->read(buffer.data() + tail, buffer.size() - tail);
+        pos = 0;
+        data = buffer.data();
+
+        return size > tail;
+    }
+
+   public:
+    // после refill в аккумуляторе не меньше MIN_BITS бит
+    static constexpr uint8_t MIN_BITS = 56;
+
+    BitReader(const uint8_t *data, size_t size)
+        : source(nullptr), data(data), size(size), pos(0), buffer_offset(0), bit_buf(0), bit_count(0), overrun(0)
+    {
+    }
+
+    // Читает source с его текущей позиции
+    explicit BitReader(InputSource &source)
+        : source(nullptr), data(nullptr), size(0), pos(0), buffer_offset(0), bit_buf(0), bit_count(0), overrun(0)
+    {
+        if (source.is_mapped())
+        {
+            data = source.data() + source.tell();
+            size = source.size() - source.tell();
+        }
+        else
+        {
+            this->source = &source;
+            buffer.resize(CHUNK_SIZE);
+            data = buffer.data();
+        }
+    }
+
+    void refill()
+    {
+        if (bit_count >= MIN_BITS)
+            return;
+
+        if (pos + 8 > size)
+            fill_buffer();
+
+        if (pos + 8 <= size)
+        {
+            // как в libdeflate: загружаем слово целиком и засчитываем столько байт, сколько поместилось;
+            // лишние старшие биты совпадают со следующим байтом и при следующей загрузке не испортятся
+            uint64_t word = 0;
+            for (uint8_t i = 0; i < 8; ++i)
+                word |= uint64_t(data[pos + i]) << (8 * i);
+
+            bit_buf |= word << bit_count;
+            pos += (63 - bit_count) >> 3;
+            bit_count |= MIN_BITS;
+            return;
+        }
+
+        // прочитанные нули за концом данных под кодом Хаффмана декодируются в символы, и обрезанный
+        // поток никогда не дошёл бы до конца блока; за концом сверх упреждающего чтения не заходим
+        if (is_overrun())
+            throw std::runtime_error("unexpected end of deflate stream");
+
+        while (bit_count < MIN_BITS)
+        {
+            uint64_t byte = 0;
+            if (pos < size)
+                byte = data[pos++];
+            else
+                ++overrun;
+
+            bit_buf |= byte << bit_count;
+            bit_count += 8;
+        }
+    }
+
+    // Следующие bits бит без продвижения; перед вызовом нужен refill
+    uint32_t peek(uint8_t bits) const { return bit_buf & ((uint64_t(1) << bits) - 1); }
+
+    void consume(uint8_t bits)
+    {
+        bit_buf >>= bits;
+        bit_count -= bits;
+    }
+
+    uint32_t read_bits(uint8_t bits)
+    {
+        refill();
+        uint32_t value = peek(bits);
+        consume(bits);
+        return value;
+    }
+
+    void align_to_byte() { consume(bit_count % 8); }
+
+    // Копирует len байт как есть; поток должен быть выровнен через align_to_byte
+    void read_bytes(uint8_t *out, size_t len)
+    {
+        // сначала то, что уже лежит в аккумуляторе
+        while (len > 0 && bit_count >= 8)
+        {
+            // младший байт аккумулятора - уже подставленный ноль за концом данных
+            if (bit_count <= overrun * 8)
+                throw std::runtime_error("unexpected end of deflate stream");
+
+            *out++ = bit_buf & 0xFF;
+            consume(8);
+            --len;
+        }
+
+        if (len == 0)
+            return;
+
+        bit_buf = 0;
+        while (len > 0)
+        {
+            if (pos == size && !fill_buffer())
+                throw std::runtime_error("unexpected end of deflate stream");
+
+            size_t count = std::min(len, size - pos);
+            memcpy(out, data + pos, count);
+            out += count;
+            pos += count;
+            len -= count;
+        }
+    }
+
+    // Кончились ли входные данные; поток должен быть выровнен через align_to_byte
+    bool is_end()
+    {
+        if (bit_count > overrun * 8)
+            return false;
+        return pos == size && !fill_buffer();
+    }
+
+    // Номер следующего непрочитанного бита от начала данных (для потока - от позиции, с которой начали читать);
+    // подставленные за концом нули загружены в аккумулятор так же, как настоящие байты
+    uint64_t get_bit_position() const { return (buffer_offset + pos + overrun) * 8 - bit_count; }
+
+    // Прочитано ли больше бит, чем было во входных данных
+    bool is_overrun() const { return overrun * 8 > bit_count; }
+};
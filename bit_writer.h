@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Запись битового потока DEFLATE: биты копятся в 64-битном аккумуляторе младшими вперёд
+// и сбрасываются в выходную строку по 8 байт.
+class BitWriter
+{
+   private:
+    std::string &out;
+    uint64_t bit_buf;
+    uint8_t bit_count;
+
+    void flush_word()
+    {
+        char bytes[8];
+        for (uint8_t i = 0; i < 8; ++i)
+            bytes[i] = static_cast<char>(bit_buf >> (8 * i));
+        out.append(bytes, 8);
+    }
+
+   public:
+    explicit BitWriter(std::string &out) : out(out), bit_buf(0), bit_count(0) {}
+
+    // Записывает младшие bits бит value, bits <= 32
+    void write_bits(uint32_t value, uint8_t bits)
+    {
+        uint64_t data = value;
+        bit_buf |= data << bit_count;
+
+        if (bit_count + bits < 64)
+        {
+            bit_count += bits;
+            return;
+        }
+
+        // аккумулятор заполнен: сбрасываем его, а не поместившиеся биты value переносим
+        flush_word();
+        uint8_t written = 64 - bit_count;
+        bit_buf = data >> written;
+        bit_count = bit_count + bits - 64;
+    }
+
+    // Дописывает нули до границы байта и переносит все накопленные биты в out
+    void align_to_byte()
+    {
+        while (bit_count > 0)
+        {
+            out.push_back(static_cast<char>(bit_buf & 0xFF));
+            bit_buf >>= 8;
+            bit_count = (bit_count > 8) ? bit_count - 8 : 0;
+        }
+        bit_buf = 0;
+    }
+
+    // Копирует байты как есть; поток должен быть выровнен через align_to_byte
+    void write_bytes(const char *data, size_t len) { out.append(data, len); }
+
+    // Номер бита внутри текущего байта
+    uint8_t get_bit_shift() const { return bit_count % 8; }
+};
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32_HAS_PCLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// CRC-32 из трейлера gzip (отражённый полином 0xEDB88320). Таблицы для slicing-by-8 строятся
+// на этапе компиляции: за шаг обрабатываются 8 байт восемью независимыми обращениями к таблицам.
+// На x86-64 с PCLMULQDQ длинные куски сворачиваются умножением без переносов (Intel, "Fast CRC
+// Computation Using PCLMULQDQ Instruction"), выбор пути делается один раз по CPUID.
+
+constexpr uint32_t CRC32_POLY = 0xEDB88320;
+
+// crc32_tables[k][b] - CRC байта b, за которым идут k нулевых байт
+constexpr std::array<std::array<uint32_t, 256>, 8> build_crc32_tables()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (uint8_t j = 0; j < 8; ++j)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+        tables[0][i] = crc;
+    }
+
+    for (uint8_t k = 1; k < 8; ++k)
+        for (uint32_t i = 0; i < 256; ++i)
+            tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+
+    return tables;
+}
+
+constexpr std::array<std::array<uint32_t, 256>, 8> crc32_tables = build_crc32_tables();
+
+static_assert(crc32_tables[0][1] == 0x77073096 && crc32_tables[0][255] == 0x2D02EF8D);
+
+// Обновляет инвертированный регистр CRC по таблицам
+inline uint32_t crc32_slice8(uint32_t crc, const uint8_t *data, size_t len)
+{
+    const auto &t = crc32_tables;
+
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ (uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 |
+                             uint32_t(data[3]) << 24);
+        uint32_t hi = uint32_t(data[4]) | uint32_t(data[5]) << 8 | uint32_t(data[6]) << 16 | uint32_t(data[7]) << 24;
+
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+
+        data += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0)
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+
+    return crc;
+}
+
+#ifdef CRC32_HAS_PCLMUL
+
+// Сдвигает 128-битный аккумулятор на расстояние, заданное парой констант k, и добавляет следующие 16 байт
+__attribute__((target("pclmul"))) inline __m128i crc32_fold(__m128i acc, __m128i k, __m128i next)
+{
+    __m128i low = _mm_clmulepi64_si128(acc, k, 0x00);
+    __m128i high = _mm_clmulepi64_si128(acc, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(high, low), next);
+}
+
+// Свёртка по 64 байта в четыре 128-битных аккумулятора, затем до 128, 64 и редукция Барретта до 32 бит.
+// Обновляет инвертированный регистр; len >= 64 и кратно 16.
+__attribute__((target("pclmul,sse4.1"))) inline uint32_t crc32_pclmul(uint32_t crc, const uint8_t *data, size_t len)
+{
+    // константы x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64 mod P и полином для Барретта
+    alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    auto load = [](const uint8_t *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); };
+
+    __m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(crc)));
+    __m128i x2 = load(data + 16);
+    __m128i x3 = load(data + 32);
+    __m128i x4 = load(data + 48);
+    data += 64;
+    len -= 64;
+
+    __m128i k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    while (len >= 64)
+    {
+        x1 = crc32_fold(x1, k, load(data));
+        x2 = crc32_fold(x2, k, load(data + 16));
+        x3 = crc32_fold(x3, k, load(data + 32));
+        x4 = crc32_fold(x4, k, load(data + 48));
+        data += 64;
+        len -= 64;
+    }
+
+    k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    x1 = crc32_fold(x1, k, x2);
+    x1 = crc32_fold(x1, k, x3);
+    x1 = crc32_fold(x1, k, x4);
+
+    while (len >= 16)
+    {
+        x1 = crc32_fold(x1, k, load(data));
+        data += 16;
+        len -= 16;
+    }
+
+    // 128 -> 64 бита
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // редукция Барретта до 32 бит
+    k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+inline bool has_pclmul()
+{
+    static const bool supported = []
+    {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+        return (ecx & bit_PCLMUL) != 0 && (ecx & bit_SSE4_1) != 0;
+    }();
+    return supported;
+}
+
+#endif
+
+// CRC-32 данных, дописанных к уже посчитанным с результатом crc; для начала crc = 0 (как crc32 в zlib)
+inline uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+
+#ifdef CRC32_HAS_PCLMUL
+    if (len >= 64 && has_pclmul())
+    {
+        size_t chunk = len & ~size_t(15);
+        crc = crc32_pclmul(crc, data, chunk);
+        data += chunk;
+        len -= chunk;
+    }
+#endif
+
+    return ~crc32_slice8(crc, data, len);
+}
+
+inline uint32_t crc32_update(uint32_t crc, const char *data, size_t len)
+{
+    return crc32_update(crc, reinterpret_cast<const uint8_t *>(data), len);
+}
+
+// Склейка CRC как в zlib: CRC конкатенации A и B равен crc_a, умноженному на x^(8 * len_b) по модулю
+// полинома, плюс crc_b. Степень собирается из таблицы x^(2^k) mod P за O(log len_b) умножений.
+
+// Произведение многочленов a и b по модулю полинома CRC (в отражённом представлении)
+constexpr uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = uint32_t(1) << 31;
+    uint32_t p = 0;
+    while (true)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+// crc32_x2n_table[k] = x^(2^k) mod P
+constexpr std::array<uint32_t, 32> build_crc32_x2n_table()
+{
+    std::array<uint32_t, 32> table{};
+    uint32_t p = uint32_t(1) << 30;  // x^1
+    table[0] = p;
+    for (uint8_t k = 1; k < 32; ++k)
+        table[k] = p = crc32_multmodp(p, p);
+    return table;
+}
+
+constexpr std::array<uint32_t, 32> crc32_x2n_table = build_crc32_x2n_table();
+
+// x^(n * 2^k) mod P
+constexpr uint32_t crc32_x2nmodp(uint64_t n, uint8_t k)
+{
+    uint32_t p = uint32_t(1) << 31;  // x^0
+    while (n)
+    {
+        if (n & 1)
+            p = crc32_multmodp(crc32_x2n_table[k & 31], p);
+        n >>= 1;
+        ++k;
+    }
+    return p;
+}
+
+// CRC-32 данных A, за которыми идут len_b байт данных B, по CRC каждой части
+constexpr uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b)
+{
+    return crc32_multmodp(crc32_x2nmodp(len_b, 3), crc_a) ^ crc_b;
+}
+
+static_assert(crc32_combine(0x352441C2, 0x0CC4E161, 3) == 0x4B8E39EF);  // "abc" + "def" = "abcdef"
+
+// Меньшие части не окупают передачу другому потоку
+constexpr size_t CRC32_PARALLEL_MIN_CHUNK = 1 << 20;
+
+// CRC-32 больших кусков в нескольких потоках. Потоки запускаются один раз и ждут работы, пока жив пул,
+// так что на каждый кусок новые не создаются. Кусок режется на части не меньше CRC32_PARALLEL_MIN_CHUNK,
+// последнюю считает вызывающий поток, а результаты склеиваются через crc32_combine.
+class Crc32Pool
+{
+   private:
+    std::mutex mutex;
+    std::condition_variable has_work;
+    std::condition_variable work_done;
+    std::vector<std::thread> workers;
+
+    // текущий кусок: части 0..parts-1 достаются рабочим по очереди
+    const uint8_t *data = nullptr;
+    size_t part_len = 0;
+    unsigned parts = 0;
+    unsigned next_part = 0;
+    unsigned done_parts = 0;
+    std::vector<uint32_t> crcs;
+    bool stopping = false;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            has_work.wait(lock, [this] { return next_part < parts || stopping; });
+            if (stopping)
+                return;
+
+            unsigned part = next_part++;
+            lock.unlock();
+            uint32_t crc = crc32_update(0, data + part * part_len, part_len);
+            lock.lock();
+
+            crcs[part] = crc;
+            if (++done_parts == parts)
+                work_done.notify_one();
+        }
+    }
+
+   public:
+    // threads - сколько потоков считают один кусок, включая вызывающий
+    explicit Crc32Pool(unsigned threads)
+    {
+        for (unsigned i = 1; i < threads; ++i)
+            workers.emplace_back([this] { work(); });
+    }
+
+    Crc32Pool(const Crc32Pool &) = delete;
+    Crc32Pool &operator=(const Crc32Pool &) = delete;
+
+    ~Crc32Pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        has_work.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    // То же, что crc32_update
+    uint32_t update(uint32_t crc, const uint8_t *buffer, size_t len)
+    {
+        unsigned count = static_cast<unsigned>(std::min<size_t>(workers.size() + 1, len / CRC32_PARALLEL_MIN_CHUNK));
+        if (count <= 1)
+            return crc32_update(crc, buffer, len);
+
+        size_t chunk = len / count;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            data = buffer;
+            part_len = chunk;
+            crcs.assign(count - 1, 0);
+            parts = count - 1;
+            next_part = done_parts = 0;
+        }
+        has_work.notify_all();
+
+        size_t last_len = len - chunk * (count - 1);
+        uint32_t last_crc = crc32_update(0, buffer + chunk * (count - 1), last_len);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_done.wait(lock, [this] { return done_parts == parts; });
+            parts = next_part = 0;
+        }
+
+        for (uint32_t part_crc : crcs)
+            crc = crc32_combine(crc, part_crc, chunk);
+        return crc32_combine(crc, last_crc, last_len);
+    }
+
+    uint32_t update(uint32_t crc, const char *buffer, size_t len)
+    {
+        return update(crc, reinterpret_cast<const uint8_t *>(buffer), len);
+    }
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "deflate_huffman.h"
+#include "deflate_tables.h"
+
+// Выбор типа блока DEFLATE по оценке его размера в битах и поиск границ блоков
+// по изменению статистики символов. Общий код для gzip_encoder.cpp и deflate_pack.cpp.
+
+constexpr size_t MAX_STORED_LEN = 65535;
+
+enum class BlockType
+{
+    STORED,
+    FIXED,
+    DYNAMIC,
+};
+
+// Биты, которые занимают дополнительные биты длин и расстояний; от типа блока не зависят
+inline size_t get_extra_bits(const std::vector<uint32_t> &lit_freqs, const std::vector<uint32_t> &dist_freqs)
+{
+    size_t bits = 0;
+    for (uint8_t i = 0; i < LENGTH_CODES; ++i)
+        bits += lit_freqs[FIRST_LENGTH_CODE + i] * length_extra_bits[i];
+    for (uint8_t i = 0; i < DIST_CODES; ++i)
+        bits += dist_freqs[i] * dist_extra_bits[i];
+    return bits;
+}
+
+inline size_t get_fixed_block_bits(const std::vector<uint32_t> &lit_freqs, const std::vector<uint32_t> &dist_freqs)
+{
+    size_t bits = 3 + get_extra_bits(lit_freqs, dist_freqs);
+    for (uint16_t i = 0; i < LIT_LEN_CODES; ++i)
+        bits += lit_freqs[i] * (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+    for (uint8_t i = 0; i < DIST_CODES; ++i)
+        bits += dist_freqs[i] * 5;
+    return bits;
+}
+
+inline size_t get_dynamic_block_bits(const DynamicCodes &codes, const std::vector<uint32_t> &lit_freqs,
+                                     const std::vector<uint32_t> &dist_freqs)
+{
+    size_t bits = 3 + 5 + 5 + 4 + 3 * codes.hclen + get_extra_bits(lit_freqs, dist_freqs);
+
+    const uint8_t extra_bits[3] = {2, 3, 7};
+    for (const auto &[symbol, extra] : codes.code_len_symbols)
+        bits += codes.code_len_lengths[symbol] + (symbol >= 16 ? extra_bits[symbol - 16] : 0);
+
+    for (uint16_t i = 0; i < LIT_LEN_CODES; ++i)
+        bits += lit_freqs[i] * codes.lit_lengths[i];
+    for (uint8_t i = 0; i < DIST_CODES; ++i)
+        bits += dist_freqs[i] * codes.dist_lengths[i];
+    return bits;
+}
+
+// len байт хранимыми блоками, если выходной поток сейчас на bit_shift бите байта
+inline size_t get_stored_block_bits(size_t len, uint8_t bit_shift)
+{
+    size_t chunks = (len + MAX_STORED_LEN - 1) / MAX_STORED_LEN;
+    if (chunks == 0)
+        chunks = 1;
+
+    // первый заголовок выравнивается от текущей позиции, остальные - от границы байта
+    size_t first_header = 3 + (8 - (bit_shift + 3) % 8) % 8;
+    return first_header + (chunks - 1) * 8 + chunks * 32 + len * 8;
+}
+
+// Самый дешёвый способ закодировать блок из len исходных байт
+inline BlockType choose_block_type(const DynamicCodes &codes, const std::vector<uint32_t> &lit_freqs,
+                                   const std::vector<uint32_t> &dist_freqs, size_t len, uint8_t bit_shift)
+{
+    size_t stored_bits = get_stored_block_bits(len, bit_shift);
+    size_t fixed_bits = get_fixed_block_bits(lit_freqs, dist_freqs);
+    size_t dynamic_bits = get_dynamic_block_bits(codes, lit_freqs, dist_freqs);
+
+    if (stored_bits < fixed_bits && stored_bits < dynamic_bits)
+        return BlockType::STORED;
+    if (fixed_bits <= dynamic_bits)
+        return BlockType::FIXED;
+    return BlockType::DYNAMIC;
+}
+
+// Грубая статистика символов блока для поиска места, где данные меняют характер (эвристика из libdeflate).
+// Литералы разбиваются на 8 групп по старшим и младшему битам, совпадения - на короткие и длинные.
+// Раз в OBSERVATIONS_PER_CHECK символов новые наблюдения сравниваются с накопленными, и если
+// распределение заметно уехало, текущий блок стоит закончить.
+class BlockSplitStats
+{
+   private:
+    static constexpr uint8_t LITERAL_OBSERVATION_TYPES = 8;
+    static constexpr uint8_t OBSERVATION_TYPES = LITERAL_OBSERVATION_TYPES + 2;
+    static constexpr uint32_t OBSERVATIONS_PER_CHECK = 512;
+    static constexpr size_t SMALL_BLOCK_LEN = 10000;
+    static constexpr uint32_t SMALL_BLOCK_OBSERVATIONS = 8192;
+
+    uint32_t new_observations[OBSERVATION_TYPES];
+    uint32_t observations[OBSERVATION_TYPES];
+    uint32_t num_new_observations;
+    uint32_t num_observations;
+
+    void merge_new_observations()
+    {
+        for (uint8_t i = 0; i < OBSERVATION_TYPES; ++i)
+        {
+            observations[i] += new_observations[i];
+            new_observations[i] = 0;
+        }
+        num_observations += num_new_observations;
+        num_new_observations = 0;
+    }
+
+   public:
+    BlockSplitStats() { reset(); }
+
+    void reset()
+    {
+        for (uint8_t i = 0; i < OBSERVATION_TYPES; ++i)
+        {
+            new_observations[i] = 0;
+            observations[i] = 0;
+        }
+        num_new_observations = 0;
+        num_observations = 0;
+    }
+
+    void observe_literal(uint8_t lit)
+    {
+        ++new_observations[((lit >> 5) & 0x6) | (lit & 1)];
+        ++num_new_observations;
+    }
+
+    void observe_match(size_t len)
+    {
+        ++new_observations[LITERAL_OBSERVATION_TYPES + (len >= 9)];
+        ++num_new_observations;
+    }
+
+    // Вызывается после каждого символа; block_len - сколько исходных байт уже в блоке
+    bool should_end_block(size_t block_len)
+    {
+        if (num_new_observations < OBSERVATIONS_PER_CHECK)
+            return false;
+
+        if (num_observations > 0)
+        {
+            uint64_t total_delta = 0;
+            for (uint8_t i = 0; i < OBSERVATION_TYPES; ++i)
+            {
+                uint64_t expected = uint64_t(observations[i]) * num_new_observations;
+                uint64_t actual = uint64_t(new_observations[i]) * num_observations;
+                total_delta += (actual > expected) ? actual - expected : expected - actual;
+            }
+
+            uint64_t num_items = num_observations + num_new_observations;
+            uint64_t cutoff = uint64_t(num_new_observations) * 200 / 512 * num_observations;
+
+            // маленький блок не стоит заголовка нового, поэтому для него порог выше
+            if (block_len < SMALL_BLOCK_LEN && num_items < SMALL_BLOCK_OBSERVATIONS)
+                cutoff += cutoff * (SMALL_BLOCK_OBSERVATIONS - num_items) / SMALL_BLOCK_OBSERVATIONS;
+
+            if (total_delta + (block_len / 4096) * num_observations >= cutoff)
+                return true;
+        }
+
+        merge_new_observations();
+        return false;
+    }
+};
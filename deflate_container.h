@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "adler32.h"
+#include "crc32.h"
+
+// Обёртки потока DEFLATE: сырой поток (RFC 1951), zlib (RFC 1950: CMF/FLG, DICTID словаря и Adler-32
+// в конце) и gzip (RFC 1952: заголовок, CRC-32 и длина в конце). Сжатые данные внутри у всех одни и те же,
+// поэтому кодер и декодер работают с потоком одинаково, а здесь только то, что вокруг него.
+
+enum class Container
+{
+    RAW,
+    ZLIB,
+    GZIP,
+};
+
+// Поля заголовка; то, чего в формате нет, при записи не используется, а при чтении остаётся пустым
+struct ContainerHeader
+{
+    bool has_dict_id = false;  // zlib: FDICT, данные сжаты с предустановленным словарём
+    uint32_t dict_id = 0;      // zlib: Adler-32 этого словаря
+    std::string file_name;     // gzip: FNAME; пустое - не пишется
+    uint32_t mtime = 0;        // gzip: время изменения, 0 - неизвестно
+    size_t block_size = 0;     // gzip: полный размер члена из подполя BC (формат BGZF); 0, если его нет
+};
+
+constexpr uint8_t ZLIB_CM_DEFLATE = 8;
+constexpr uint8_t ZLIB_CINFO_32K = 7;  // окно 2^(7 + 8) байт
+constexpr uint8_t ZLIB_FLAG_FDICT = 1 << 5;
+constexpr uint8_t ZLIB_FLEVEL_DEFAULT = 2 << 6;
+constexpr uint8_t GZIP_ID1 = 0x1F;
+constexpr uint8_t GZIP_ID2 = 0x8B;
+constexpr uint8_t GZIP_CM_DEFLATE = 8;
+constexpr uint8_t GZIP_FLAG_FHCRC = 1 << 1;
+constexpr uint8_t GZIP_FLAG_FEXTRA = 1 << 2;
+constexpr uint8_t GZIP_FLAG_FNAME = 1 << 3;
+constexpr uint8_t GZIP_FLAG_FCOMMENT = 1 << 4;
+constexpr uint8_t GZIP_OS_UNKNOWN = 0xFF;
+
+// Контрольная сумма данных внутри обёртки: Adler-32 у zlib, CRC-32 у gzip; у сырого потока её нет
+class ContainerChecksum
+{
+   private:
+    Container container;
+    uint32_t checksum;
+    uint64_t total;
+
+   public:
+    explicit ContainerChecksum(Container container)
+        : container(container), checksum(container == Container::ZLIB ? 1 : 0), total(0)
+    {
+    }
+
+    void update(const char *data, size_t len)
+    {
+        if (container == Container::ZLIB)
+            checksum = adler32_update(checksum, data, len);
+        else if (container == Container::GZIP)
+            checksum = crc32_update(checksum, data, len);
+        total += len;
+    }
+
+    uint32_t value() const { return checksum; }
+    uint64_t size() const { return total; }
+};
+
+inline void append_uint_le(std::string &out, uint32_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; ++i)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+inline void append_uint_be(std::string &out, uint32_t value, uint8_t bytes)
+{
+    for (uint8_t i = bytes; i > 0; --i)
+        out.push_back(static_cast<char>((value >> (8 * (i - 1))) & 0xFF));
+}
+
+inline uint32_t read_uint_le(const uint8_t *data, uint8_t bytes)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; ++i)
+        value |= uint32_t(data[i]) << (8 * i);
+    return value;
+}
+
+inline uint32_t read_uint_be(const uint8_t *data, uint8_t bytes)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; ++i)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+inline void write_container_header(std::string &out, Container container,
+                                   const ContainerHeader &header = ContainerHeader())
+{
+    if (container == Container::ZLIB)
+    {
+        uint8_t cmf = (ZLIB_CINFO_32K << 4) | ZLIB_CM_DEFLATE;
+        uint8_t flg = ZLIB_FLEVEL_DEFAULT | (header.has_dict_id ? ZLIB_FLAG_FDICT : 0);
+        // FCHECK дополняет CMF * 256 + FLG до кратного 31
+        flg += (31 - (cmf * 256 + flg) % 31) % 31;
+
+        out.push_back(static_cast<char>(cmf));
+        out.push_back(static_cast<char>(flg));
+        if (header.has_dict_id)
+            append_uint_be(out, header.dict_id, 4);
+    }
+    else if (container == Container::GZIP)
+    {
+        if (header.has_dict_id)
+            throw std::runtime_error("gzip does not support preset dictionaries");
+
+        out.push_back(static_cast<char>(GZIP_ID1));
+        out.push_back(static_cast<char>(GZIP_ID2));
+        out.push_back(static_cast<char>(GZIP_CM_DEFLATE));
+        out.push_back(static_cast<char>(header.file_name.empty() ? 0 : GZIP_FLAG_FNAME));
+        append_uint_le(out, header.mtime, 4);
+        out.push_back(0);  // XFL
+        out.push_back(static_cast<char>(GZIP_OS_UNKNOWN));
+
+        if (!header.file_name.empty())
+        {
+            out += header.file_name;
+            out.push_back(0);
+        }
+    }
+}
+
+// checksum и size - контрольная сумма и длина несжатых данных (у gzip длина хранится по модулю 2^32)
+inline void write_container_trailer(std::string &out, Container container, uint32_t checksum, uint64_t size)
+{
+    if (container == Container::ZLIB)
+        append_uint_be(out, checksum, 4);
+    else if (container == Container::GZIP)
+    {
+        append_uint_le(out, checksum, 4);
+        append_uint_le(out, static_cast<uint32_t>(size), 4);
+    }
+}
+
+// Разбирает заголовок члена gzip (RFC 1952, 2.3) и возвращает его длину. Байты берутся через
+// read(uint8_t *out, size_t len), которая бросает исключение, если их не хватает: так заголовок
+// читается и из буфера в памяти, и прямо из потока перед сжатыми данными.
+template <typename ReadBytes>
+size_t read_gzip_header(ReadBytes &&read, ContainerHeader &header)
+{
+    header = ContainerHeader();
+
+    uint8_t fixed[10];
+    read(fixed, 10);
+    if (fixed[0] != GZIP_ID1 || fixed[1] != GZIP_ID2)
+        throw std::runtime_error("not in gzip format");
+    if (fixed[2] != GZIP_CM_DEFLATE)
+        throw std::runtime_error("unsupported gzip compression method");
+
+    uint8_t flags = fixed[3];
+    header.mtime = read_uint_le(fixed + 4, 4);
+    size_t len = 10;
+
+    if (flags & GZIP_FLAG_FEXTRA)
+    {
+        // подполя: два байта идентификатора, длина и данные; BGZF пишет 'B', 'C' и размер члена минус один
+        uint8_t xlen_bytes[2];
+        read(xlen_bytes, 2);
+        size_t xlen = read_uint_le(xlen_bytes, 2);
+        len += 2 + xlen;
+
+        std::vector<uint8_t> extra(xlen);
+        read(extra.data(), xlen);
+        for (size_t i = 0; i + 4 <= xlen;)
+        {
+            size_t field_len = read_uint_le(&extra[i + 2], 2);
+            if (extra[i] == 'B' && extra[i + 1] == 'C' && field_len == 2 && i + 6 <= xlen)
+                header.block_size = read_uint_le(&extra[i + 4], 2) + 1;
+            i += 4 + field_len;
+        }
+    }
+
+    for (uint8_t flag : {GZIP_FLAG_FNAME, GZIP_FLAG_FCOMMENT})
+    {
+        if (!(flags & flag))
+            continue;
+
+        // строка до нулевого байта
+        std::string str;
+        uint8_t ch;
+        for (read(&ch, 1); ch != 0; read(&ch, 1))
+            str.push_back(static_cast<char>(ch));
+        len += str.size() + 1;
+        if (flag == GZIP_FLAG_FNAME)
+            header.file_name = std::move(str);
+    }
+
+    if (flags & GZIP_FLAG_FHCRC)
+    {
+        uint8_t hcrc[2];
+        read(hcrc, 2);
+        len += 2;
+    }
+
+    if (header.block_size != 0 && header.block_size < len + 8)
+        throw std::runtime_error("invalid BGZF block size");
+    return len;
+}
+
+// Разбирает заголовок в начале data[0, size) и возвращает его длину - с неё начинается поток DEFLATE
+inline size_t read_container_header(const uint8_t *data, size_t size, Container container, ContainerHeader &header)
+{
+    header = ContainerHeader();
+
+    auto need = [size](size_t len)
+    {
+        if (len > size)
+            throw std::runtime_error("truncated container header");
+    };
+
+    if (container == Container::ZLIB)
+    {
+        need(2);
+        uint8_t cmf = data[0];
+        uint8_t flg = data[1];
+        if ((cmf & 0x0F) != ZLIB_CM_DEFLATE || (cmf >> 4) > ZLIB_CINFO_32K)
+            throw std::runtime_error("unsupported zlib compression method");
+        if ((cmf * 256 + flg) % 31 != 0)
+            throw std::runtime_error("invalid zlib header check");
+
+        if (!(flg & ZLIB_FLAG_FDICT))
+            return 2;
+
+        need(6);
+        header.has_dict_id = true;
+        header.dict_id = read_uint_be(data + 2, 4);
+        return 6;
+    }
+
+    if (container == Container::GZIP)
+    {
+        size_t pos = 0;
+        return read_gzip_header(
+            [&](uint8_t *out, size_t len)
+            {
+                need(pos + len);
+                std::copy(data + pos, data + pos + len, out);
+                pos += len;
+            },
+            header);
+    }
+
+    return 0;
+}
+
+inline size_t container_trailer_size(Container container)
+{
+    return (container == Container::ZLIB) ? 4 : (container == Container::GZIP) ? 8 : 0;
+}
+
+// Сверяет трейлер в начале data[0, size) с контрольной суммой распакованных данных
+inline void check_container_trailer(const uint8_t *data, size_t size, Container container,
+                                    const ContainerChecksum &checksum)
+{
+    if (size < container_trailer_size(container))
+        throw std::runtime_error("truncated container trailer");
+
+    if (container == Container::ZLIB && read_uint_be(data, 4) != checksum.value())
+        throw std::runtime_error("Adler-32 mismatch");
+
+    if (container == Container::GZIP)
+    {
+        if (read_uint_le(data, 4) != checksum.value())
+            throw std::runtime_error("CRC-32 mismatch");
+        if (read_uint_le(data + 4, 4) != static_cast<uint32_t>(checksum.size()))
+            throw std::runtime_error("length mismatch");
+    }
+}
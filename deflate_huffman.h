@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "bit_writer.h"
+#include "deflate_tables.h"
+
+// Построение динамических кодов Хаффмана для блоков DEFLATE с BTYPE=10 (RFC 1951, 3.2.7).
+// Общий код для gzip_encoder.cpp и deflate_pack.cpp.
+
+// Символ алфавита длин кодов: 0..15 - сама длина, 16 - повтор предыдущей 3..6 раз,
+// 17 - 3..10 нулей, 18 - 11..138 нулей
+struct CodeLenSymbol
+{
+    uint8_t symbol;
+    uint8_t extra;
+};
+
+// Коды литералов/длин и расстояний, которыми кодируются символы блока
+struct BlockCodes
+{
+    std::vector<uint8_t> lit_lengths;
+    std::vector<uint16_t> lit_codes;
+    std::vector<uint8_t> dist_lengths;
+    std::vector<uint16_t> dist_codes;
+};
+
+// Коды динамического блока вместе с описанием его заголовка
+struct DynamicCodes : BlockCodes
+{
+    std::vector<uint8_t> code_len_lengths;
+    std::vector<uint16_t> code_len_codes;
+    std::vector<CodeLenSymbol> code_len_symbols;
+
+    uint16_t hlit;  // сколько кодов литералов/длин передаётся, 257..286
+    uint8_t hdist;  // сколько кодов расстояний передаётся, 1..30
+    uint8_t hclen;  // сколько длин кодов для алфавита длин передаётся, 4..19
+};
+
+// Рабочие буферы построения кодов. Их память переиспользуется от блока к блоку,
+// так что в установившемся режиме построение кодов ничего не выделяет.
+struct HuffmanScratch
+{
+    struct Node
+    {
+        uint64_t weight;
+        int left;
+        int right;
+    };
+
+    using Item = std::pair<uint64_t, int>;
+
+    std::vector<size_t> symbols;
+    std::vector<Node> nodes;
+    std::vector<Item> queue;  // куча с минимумом наверху
+    std::vector<std::pair<int, uint8_t>> stack;
+    std::vector<uint8_t> all_lengths;
+    std::vector<uint32_t> code_len_freqs;
+};
+
+// Длины кодов Хаффмана для частот freqs, не превышающие max_bits
+inline void build_code_lengths(const std::vector<uint32_t> &freqs, uint8_t max_bits, std::vector<uint8_t> &lengths,
+                               HuffmanScratch &scratch)
+{
+    lengths.assign(freqs.size(), 0);
+
+    std::vector<size_t> &symbols = scratch.symbols;
+    symbols.clear();
+    for (size_t i = 0; i < freqs.size(); ++i)
+        if (freqs[i] > 0)
+            symbols.push_back(i);
+
+    // полный код из одного слова не построить, поэтому добавляем второе
+    if (symbols.size() < 2)
+    {
+        size_t used = symbols.empty() ? 0 : symbols[0];
+        lengths[used] = 1;
+        lengths[used == 0 ? 1 : 0] = 1;
+        return;
+    }
+
+    using Item = HuffmanScratch::Item;
+    std::vector<HuffmanScratch::Node> &nodes = scratch.nodes;
+    std::vector<Item> &queue = scratch.queue;
+    nodes.clear();
+    queue.clear();
+
+    auto push = [&queue](Item item)
+    {
+        queue.push_back(item);
+        std::push_heap(queue.begin(), queue.end(), std::greater<Item>());
+    };
+    auto pop = [&queue]
+    {
+        std::pop_heap(queue.begin(), queue.end(), std::greater<Item>());
+        Item item = queue.back();
+        queue.pop_back();
+        return item;
+    };
+
+    for (size_t s : symbols)
+    {
+        push({freqs[s], static_cast<int>(nodes.size())});
+        nodes.push_back({freqs[s], -1, static_cast<int>(s)});
+    }
+
+    while (queue.size() > 1)
+    {
+        auto [w1, a] = pop();
+        auto [w2, b] = pop();
+
+        push({w1 + w2, static_cast<int>(nodes.size())});
+        nodes.push_back({w1 + w2, a, b});
+    }
+
+    // у листьев left == -1, а в right хранится символ
+    std::vector<std::pair<int, uint8_t>> &stack = scratch.stack;
+    stack.assign(1, {queue.front().second, 0});
+    bool overflow = false;
+    while (!stack.empty())
+    {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+
+        if (nodes[node].left == -1)
+        {
+            lengths[nodes[node].right] = depth;
+            overflow |= depth > max_bits;
+        }
+        else
+        {
+            stack.push_back({nodes[node].left, depth + 1});
+            stack.push_back({nodes[node].right, depth + 1});
+        }
+    }
+
+    if (!overflow)
+        return;
+
+    // обрезаем слишком длинные коды и восстанавливаем неравенство Крафта,
+    // удлиняя самые редкие коды и затем укорачивая самые частые, пока код не станет полным
+    const uint64_t capacity = uint64_t(1) << max_bits;
+    uint64_t kraft = 0;
+    for (size_t s : symbols)
+    {
+        lengths[s] = std::min(lengths[s], max_bits);
+        kraft += uint64_t(1) << (max_bits - lengths[s]);
+    }
+
+    std::sort(symbols.begin(), symbols.end(), [&](size_t a, size_t b) { return freqs[a] < freqs[b]; });
+
+    while (kraft > capacity)
+    {
+        size_t longest = symbols.size();
+        for (size_t i = 0; i < symbols.size(); ++i)
+            if (lengths[symbols[i]] < max_bits &&
+                (longest == symbols.size() || lengths[symbols[i]] > lengths[symbols[longest]]))
+                longest = i;
+
+        size_t s = symbols[longest];
+        kraft -= uint64_t(1) << (max_bits - lengths[s] - 1);
+        ++lengths[s];
+    }
+
+    for (auto it = symbols.rbegin(); it != symbols.rend() && kraft < capacity;)
+    {
+        uint64_t gain = uint64_t(1) << (max_bits - lengths[*it]);
+        if (lengths[*it] > 1 && kraft + gain <= capacity)
+        {
+            kraft += gain;
+            --lengths[*it];
+        }
+        else
+            ++it;
+    }
+}
+
+// Канонические коды (RFC 1951, 3.2.2) по длинам. Код передаётся старшим битом вперёд, поэтому
+// здесь он сразу развёрнут для BitWriter, который пишет младшие биты первыми
+inline void build_canonical_codes(const std::vector<uint8_t> &lengths, std::vector<uint16_t> &codes)
+{
+    uint16_t bl_count[MAX_CODE_BITS + 1] = {};
+    for (uint8_t len : lengths)
+        ++bl_count[len];
+    bl_count[0] = 0;
+
+    uint16_t next_code[MAX_CODE_BITS + 1] = {};
+    uint16_t code = 0;
+    for (uint8_t bits = 1; bits <= MAX_CODE_BITS; ++bits)
+    {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+
+    codes.assign(lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); ++i)
+    {
+        if (lengths[i] == 0)
+            continue;
+
+        uint16_t code = next_code[lengths[i]]++;
+        uint16_t reversed = 0;
+        for (uint8_t bit = 0; bit < lengths[i]; ++bit)
+            reversed |= ((code >> bit) & 1) << (lengths[i] - 1 - bit);
+        codes[i] = reversed;
+    }
+}
+
+// RLE-сжатие последовательности длин кодов символами 16, 17 и 18
+inline void build_code_len_symbols(const std::vector<uint8_t> &lengths, std::vector<CodeLenSymbol> &result)
+{
+    result.clear();
+
+    size_t i = 0;
+    while (i < lengths.size())
+    {
+        uint8_t len = lengths[i];
+        size_t run = 1;
+        while (i + run < lengths.size() && lengths[i + run] == len)
+            ++run;
+        i += run;
+
+        if (len == 0)
+        {
+            while (run >= 11)
+            {
+                size_t count = std::min<size_t>(run, 138);
+                result.push_back({18, static_cast<uint8_t>(count - 11)});
+                run -= count;
+            }
+            if (run >= 3)
+            {
+                result.push_back({17, static_cast<uint8_t>(run - 3)});
+                run = 0;
+            }
+        }
+        else
+        {
+            result.push_back({len, 0});
+            --run;
+            while (run >= 3)
+            {
+                size_t count = std::min<size_t>(run, 6);
+                result.push_back({16, static_cast<uint8_t>(count - 3)});
+                run -= count;
+            }
+        }
+
+        for (; run > 0; --run)
+            result.push_back({len, 0});
+    }
+}
+
+// Строит в codes коды литералов/длин и расстояний по частотам символов блока и описание заголовка;
+// память codes и scratch от прошлых блоков переиспользуется
+inline void build_dynamic_codes(const std::vector<uint32_t> &lit_freqs, const std::vector<uint32_t> &dist_freqs,
+                                DynamicCodes &codes, HuffmanScratch &scratch)
+{
+    build_code_lengths(lit_freqs, MAX_CODE_BITS, codes.lit_lengths, scratch);
+    build_canonical_codes(codes.lit_lengths, codes.lit_codes);
+    build_code_lengths(dist_freqs, MAX_CODE_BITS, codes.dist_lengths, scratch);
+    build_canonical_codes(codes.dist_lengths, codes.dist_codes);
+
+    codes.hlit = LIT_LEN_CODES;
+    while (codes.hlit > 257 && codes.lit_lengths[codes.hlit - 1] == 0)
+        --codes.hlit;
+
+    codes.hdist = DIST_CODES;
+    while (codes.hdist > 1 && codes.dist_lengths[codes.hdist - 1] == 0)
+        --codes.hdist;
+
+    // длины обоих алфавитов сжимаются одной общей последовательностью
+    std::vector<uint8_t> &all_lengths = scratch.all_lengths;
+    all_lengths.assign(codes.lit_lengths.begin(), codes.lit_lengths.begin() + codes.hlit);
+    all_lengths.insert(all_lengths.end(), codes.dist_lengths.begin(), codes.dist_lengths.begin() + codes.hdist);
+    build_code_len_symbols(all_lengths, codes.code_len_symbols);
+
+    std::vector<uint32_t> &code_len_freqs = scratch.code_len_freqs;
+    code_len_freqs.assign(CODE_LEN_CODES, 0);
+    for (const auto &[symbol, extra] : codes.code_len_symbols)
+        ++code_len_freqs[symbol];
+
+    build_code_lengths(code_len_freqs, MAX_CODE_LEN_BITS, codes.code_len_lengths, scratch);
+    build_canonical_codes(codes.code_len_lengths, codes.code_len_codes);
+
+    codes.hclen = CODE_LEN_CODES;
+    while (codes.hclen > 4 && codes.code_len_lengths[code_len_order[codes.hclen - 1]] == 0)
+        --codes.hclen;
+}
+
+inline DynamicCodes build_dynamic_codes(const std::vector<uint32_t> &lit_freqs, const std::vector<uint32_t> &dist_freqs)
+{
+    DynamicCodes codes;
+    HuffmanScratch scratch;
+    build_dynamic_codes(lit_freqs, dist_freqs, codes, scratch);
+    return codes;
+}
+
+// Коды статического блока (BTYPE=01, RFC 1951, 3.2.6) - тоже канонические, с фиксированными длинами
+inline const BlockCodes &get_fixed_codes()
+{
+    static const BlockCodes codes = []
+    {
+        BlockCodes result;
+
+        result.lit_lengths.assign(FIXED_LIT_LEN_CODES, 8);
+        std::fill(result.lit_lengths.begin() + 144, result.lit_lengths.begin() + 256, 9);
+        std::fill(result.lit_lengths.begin() + 256, result.lit_lengths.begin() + 280, 7);
+        build_canonical_codes(result.lit_lengths, result.lit_codes);
+
+        result.dist_lengths.assign(DIST_CODES, 5);
+        build_canonical_codes(result.dist_lengths, result.dist_codes);
+
+        return result;
+    }();
+
+    return codes;
+}
+
+// Заголовок динамического блока после BFINAL и BTYPE: HLIT, HDIST, HCLEN и длины кодов
+inline void write_dynamic_header(BitWriter &writer, const DynamicCodes &codes)
+{
+    writer.write_bits(codes.hlit - 257, 5);
+    writer.write_bits(codes.hdist - 1, 5);
+    writer.write_bits(codes.hclen - 4, 4);
+
+    for (uint8_t i = 0; i < codes.hclen; ++i)
+        writer.write_bits(codes.code_len_lengths[code_len_order[i]], 3);
+
+    const uint8_t extra_bits[3] = {2, 3, 7};
+    for (const auto &[symbol, extra] : codes.code_len_symbols)
+    {
+        writer.write_bits(codes.code_len_codes[symbol], codes.code_len_lengths[symbol]);
+        if (symbol >= 16)
+            writer.write_bits(extra, extra_bits[symbol - 16]);
+    }
+}
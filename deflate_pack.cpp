@@ -4,285 +4,590 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "bit_writer.h"
+#include "deflate_block.h"
+#include "deflate_container.h"
+#include "deflate_huffman.h"
+#include "deflate_stream.h"
+#include "deflate_tables.h"
+#include "match_length.h"
+
 using namespace std;
 
-struct Match
+// Совпадение-кандидат для оптимального разбора
+struct MatchCandidate
 {
-    size_t distance;
-    size_t length;
-    char next_char;
+    uint16_t length;
+    uint16_t distance;
+};
 
-    Match(size_t d, size_t l) : distance(d), length(l), next_char('\0') {}
-    Match(size_t d, size_t l, char ch) : distance(d), length(l), next_char(ch) {}
+enum class ParseMode
+{
+    GREEDY,   // с каждой позиции самое длинное совпадение из цепочки хешей
+    OPTIMAL,  // кратчайший путь по цене в битах среди всех совпадений из двоичного дерева
 };
 
+// Контекст сжатия: цепочки хешей, найденные совпадения, частоты, коды Хаффмана и выходной буфер живут
+// в объекте и переиспользуются от вызова к вызову, так что после первых вызовов encode память
+// больше не выделяет (если вход не вырос).
 class Encoder
 {
+   public:
+    class Dictionary;
+
    private:
-    const size_t BLOCK_SIZE = 65536;
-    const size_t WINDOW_SIZE = 32768;
-    const u_int16_t MIN_MATCH_LEN = 3;
-    const u_int16_t MAX_MATCH_LEN = 258;
-    const string BTYPE_FIXED = "10";  // reverse order for packing
-    const string END_OF_BLOCK = "0000000";
-
-    // base_len - code, +bits, huff_code
-    map<u_int16_t, tuple<u_int16_t, u_int8_t, string>> len_table = {
-        {3, {257, 0, "0000001"}},    {4, {258, 0, "0000010"}},    {5, {259, 0, "0000011"}},
-        {6, {260, 0, "0000100"}},    {7, {261, 0, "0000101"}},    {8, {262, 0, "0000110"}},
-        {9, {263, 0, "0000111"}},    {10, {264, 0, "0001000"}},   {11, {265, 1, "0001001"}},
-        {13, {266, 1, "0001010"}},   {15, {267, 1, "0001011"}},   {17, {268, 2, "0001100"}},
-        {21, {269, 2, "0001101"}},   {25, {270, 2, "0001110"}},   {29, {271, 2, "0001111"}},
-        {33, {272, 3, "0010000"}},   {41, {273, 3, "0010001"}},   {49, {274, 3, "0010010"}},
-        {57, {275, 3, "0010011"}},   {65, {276, 4, "0010100"}},   {81, {277, 4, "0010101"}},
-        {97, {278, 4, "0010110"}},   {113, {279, 4, "0010111"}},  {129, {280, 5, "11000000"}},
-        {161, {281, 5, "11000001"}}, {193, {282, 5, "11000010"}}, {225, {283, 5, "11000011"}},
-        {257, {284, 5, "11000100"}}, {258, {285, 0, "11000101"}},
-    };
+    const size_t MAX_CHAIN = 256;
+    const size_t MAX_TREE_DEPTH = 256;
+    const size_t SEGMENT_SIZE = 65536;  // оптимальный разбор идёт кусками такой длины
+    const u_int8_t OPTIMAL_ITERATIONS = 6;
+
+    // Цепочки хешей трёх байт: head - последняя позиция с таким хешем, prev - предыдущая для каждой
+    // позиции окна. Позиции сквозные для всех входов, поэтому таблицы не нужно чистить:
+    // всё, что меньше base, осталось от прошлых вызовов и пропускается.
+    vector<size_t> head;
+    vector<size_t> prev;
+    size_t base;       // сквозная позиция начала текущего входа
+    size_t next_base;  // с неё начнётся следующий вход
+
+    ParseMode mode;
+    const Dictionary* dictionary;  // словарь текущего вызова encode или nullptr
+
+    // Двоичные деревья для OPTIMAL: tree_head - корень дерева позиций с данным хешем, у каждой
+    // позиции окна два потомка в tree_children. Позиции сквозные, как в head/prev.
+    vector<size_t> tree_head;
+    vector<size_t> tree_children;
+
+    // Рабочие буферы оптимального разбора куска: кандидаты позиции i лежат в
+    // candidates[candidate_ends[i], candidate_ends[i + 1]), по возрастанию длины
+    vector<MatchCandidate> candidates;
+    vector<uint32_t> candidate_ends;
+    vector<uint32_t> path_cost;           // цена лучшего пути до позиции
+    vector<MatchCandidate> path_choice;   // последний шаг этого пути; distance == 0 - литерал
+    vector<Match> trial_matches;          // разбор текущего прохода
+    vector<Match> best_matches;           // самый дешёвый разбор из всех проходов
+    vector<uint8_t> lit_lengths;
+    vector<uint8_t> dist_lengths;
+    uint32_t lit_cost[LIT_LEN_CODES];
+    uint32_t dist_cost[DIST_CODES];
+
+    vector<Match> matches;
+    vector<size_t> block_ends;  // для каждого блока - индекс в matches за его последним символом
+    BlockScratch block_scratch;  // частоты и коды блока; update_costs считает в них же
+    string result;
+    string alternative;  // для OPTIMAL: тот же вход, сжатый обычным разбором
+
+    void insert_hash(const string& src, size_t pos)
+    {
+        if (pos + MIN_MATCH_LEN > src.size())
+            return;
 
-    // base_dist - code, +bits, huff_code
-    map<u_int16_t, tuple<u_int8_t, u_int8_t, string>> dist_table = {
-        {1, {0, 0, "00000"}},       {2, {1, 0, "00001"}},       {3, {2, 0, "00010"}},      {4, {3, 0, "00011"}},
-        {5, {4, 1, "00100"}},       {7, {5, 1, "00101"}},       {9, {6, 2, "00110"}},      {13, {7, 2, "00111"}},
-        {17, {8, 3, "01000"}},      {25, {9, 3, "01001"}},      {33, {10, 4, "01010"}},    {49, {11, 4, "01011"}},
-        {65, {12, 5, "01100"}},     {97, {13, 5, "01101"}},     {129, {14, 6, "01110"}},   {193, {15, 6, "01111"}},
-        {257, {16, 7, "10000"}},    {385, {17, 7, "10001"}},    {513, {18, 8, "10010"}},   {769, {19, 8, "10011"}},
-        {1025, {20, 9, "10100"}},   {1537, {21, 9, "10101"}},   {2049, {22, 10, "10110"}}, {3073, {23, 10, "10111"}},
-        {4097, {24, 11, "11000"}},  {6145, {25, 11, "11001"}},  {8193, {26, 12, "11010"}}, {12289, {27, 12, "11011"}},
-        {16385, {28, 13, "11100"}}, {24577, {29, 13, "11101"}},
-    };
+        size_t hash = get_hash(src.data(), pos);
+        prev[(base + pos) & WINDOW_MASK] = head[hash];
+        head[hash] = base + pos;
+    }
 
-    vector<Match> find_matches(const string& src)
+    // жадный разбор: с каждой позиции берём самое длинное совпадение из первых MAX_CHAIN кандидатов цепочки
+    void find_matches(const string& src)
     {
-        vector<Match> matches;
+        matches.clear();
 
         size_t pos = 0;
         while (pos < src.size())
         {
             Match best_match(0, 1, src[pos]);
-            size_t start = (pos >= WINDOW_SIZE) ? pos - WINDOW_SIZE : 0;
 
-            for (size_t i = start; i < pos; ++i)
+            if (pos + MIN_MATCH_LEN <= src.size())
             {
-                size_t match_len = 0;
-                while (match_len < MAX_MATCH_LEN && pos + match_len < src.size() &&
-                       src[start + match_len] == src[pos + match_len])
-                    ++match_len;
+                size_t max_len = min<size_t>(MAX_MATCH_LEN, src.size() - pos);
+                size_t candidate = head[get_hash(src.data(), pos)];
 
-                if (match_len >= MIN_MATCH_LEN && match_len > best_match.length)
+                for (size_t chain = 0; chain < MAX_CHAIN && candidate >= base && base + pos - candidate <= WINDOW_SIZE;
+                     ++chain)
                 {
-                    best_match = Match(pos - start, match_len, src[pos]);
+                    size_t start = candidate - base;
+                    size_t match_len = match_length(src.data() + start, src.data() + pos, max_len);
+
+                    if (match_len >= MIN_MATCH_LEN && match_len > best_match.length)
+                    {
+                        best_match = Match(pos - start, match_len, src[pos]);
+                        if (match_len == max_len)
+                            break;
+                    }
+
+                    candidate = prev[candidate & WINDOW_MASK];
                 }
-            }
 
-            if (best_match.length >= MIN_MATCH_LEN)
-            {
-                matches.push_back(best_match);
-                pos += best_match.length;
-            }
-            else
-            {
-                matches.emplace_back(0, 1, src[pos]);
-                ++pos;
+                if (dictionary != nullptr && best_match.length < max_len)
+                {
+                    search_dictionary(src, pos, max_len, max<size_t>(best_match.length, MIN_MATCH_LEN - 1),
+                                      [&](size_t length, size_t distance)
+                                      { best_match = Match(distance, length, src[pos]); });
+                }
             }
-        }
 
-        return matches;
+            matches.push_back(best_match);
+            for (size_t i = 0; i < best_match.length; ++i)
+                insert_hash(src, pos + i);
+            pos += best_match.length;
+        }
     }
 
-    vector<vector<Match>> split_into_blocks(const vector<Match>& matches)
+    // блок заканчивается, когда он вырос до BLOCK_SIZE исходных байт или когда статистика символов заметно изменилась
+    void split_into_blocks()
     {
-        vector<vector<Match>> blocks;
+        block_ends.clear();
 
         size_t curr_size = 0;
-        vector<Match> block;
-        for (const auto& match : matches)
+        BlockSplitStats split_stats;
+        for (size_t i = 0; i < matches.size(); ++i)
         {
+            const Match& match = matches[i];
             if (curr_size + match.length > BLOCK_SIZE)
             {
-                blocks.push_back(block);
-                block.clear();
+                block_ends.push_back(i);
                 curr_size = 0;
+                split_stats.reset();
             }
 
-            block.push_back(match);
             curr_size += match.length;
+
+            if (match.distance == 0)
+                split_stats.observe_literal(match.next_char);
+            else
+                split_stats.observe_match(match.length);
+
+            if (split_stats.should_end_block(curr_size))
+            {
+                block_ends.push_back(i + 1);
+                curr_size = 0;
+                split_stats.reset();
+            }
         }
 
-        if (curr_size > 0)
+        if (curr_size > 0 || block_ends.empty())
         {
-            blocks.push_back(block);
+            block_ends.push_back(matches.size());
         }
-
-        return blocks;
     }
 
-    string get_literal_fixed_code(char ch)
+    // Ищет совпадения для pos в словаре, которые длиннее best_len и не дальше окна. Совпадение,
+    // дошедшее до конца словаря, продолжается с начала src, как если бы src шёл сразу за ним.
+    // Каждое найденное совпадение длиннее предыдущего передаётся в on_match(length, distance).
+    template <typename OnMatch>
+    void search_dictionary(const string& src, size_t pos, size_t max_len, size_t best_len, OnMatch on_match) const
     {
-        uint code;
-        string result;
-        if (static_cast<u_int8_t>(ch) < 144)
-        {
-            code = 0x30 + ch;
-            result = bitset<8>(code).to_string();
-        }
-        else
+        const string& data = dictionary->data;
+        size_t candidate = dictionary->head[get_hash(src.data(), pos)];
+
+        for (size_t chain = 0;
+             chain < MAX_CHAIN && candidate != NO_POS && pos + data.size() - candidate <= WINDOW_SIZE;
+             ++chain)
         {
-            code = 0x190 + (ch - 144);
-            result = bitset<9>(code).to_string();
-        }
+            size_t tail = data.size() - candidate;
+            size_t len = match_length(data.data() + candidate, src.data() + pos, min(max_len, tail));
+            if (len == tail)
+                len += match_length(src.data(), src.data() + pos + tail, max_len - tail);
 
-        return result;
+            if (len > best_len)
+            {
+                best_len = len;
+                on_match(len, pos + tail);
+                if (len == max_len)
+                    break;
+            }
+
+            candidate = dictionary->prev[candidate];
+        }
     }
 
-    string get_distance_fixed_code(u_int16_t dist)
+    // Вставляет pos в двоичное дерево её хеша и, если record, дописывает в candidates совпадения
+    // с ней, каждое длиннее предыдущего. Дерево упорядочено по строкам, начинающимся с позиций
+    // (как bt_matchfinder в libdeflate): один спуск и находит совпадения, и перестраивает дерево
+    // так, что pos становится корнем. Сравнение идёт не дальше max_len >= MIN_MATCH_LEN байт.
+    void insert_tree(const string& src, size_t pos, size_t max_len, bool record)
     {
-        auto it = dist_table.upper_bound(dist);
-        --it;
+        size_t current = base + pos;
+        size_t* pending_lt = &tree_children[2 * (current & WINDOW_MASK)];
+        size_t* pending_gt = pending_lt + 1;
+
+        size_t hash = get_hash(src.data(), pos);
+        size_t candidate = tree_head[hash];
+        tree_head[hash] = current;
 
-        u_int16_t base_dist = it->first;
-        auto [code, bits, huff] = it->second;
+        // строки левого поддерева меньше строки pos, правого - больше; с каждой стороны все они
+        // совпадают с ней хотя бы на best_lt_len и best_gt_len байт, так что сравнение начинается с меньшего
+        size_t best_lt_len = 0;
+        size_t best_gt_len = 0;
+        size_t best_len = MIN_MATCH_LEN - 1;
 
-        string code_str = huff;
-        u_int16_t dist_diff = dist - base_dist;
-        for (u_int8_t i = 0; i < bits; ++i)
+        for (size_t depth = 0;; ++depth)
         {
-            char bit = ((dist_diff >> i) & 1) ? '1' : '0';
-            code_str.push_back(bit);
+            // у слота позиции ровно на WINDOW_SIZE раньше тот же индекс, что и у current, поэтому она уже не годится
+            if (candidate < base || current - candidate >= WINDOW_SIZE || depth == MAX_TREE_DEPTH)
+            {
+                *pending_lt = 0;
+                *pending_gt = 0;
+                return;
+            }
+
+            size_t start = candidate - base;
+            size_t len = match_length(src.data() + start, src.data() + pos, max_len, min(best_lt_len, best_gt_len));
+
+            if (len > best_len)
+            {
+                best_len = len;
+                if (record)
+                    candidates.push_back({static_cast<uint16_t>(len), static_cast<uint16_t>(pos - start)});
+            }
+
+            size_t* children = &tree_children[2 * (candidate & WINDOW_MASK)];
+            if (len == max_len)
+            {
+                // строки равны на всей длине сравнения: pos занимает место candidate вместе с его потомками
+                *pending_lt = children[0];
+                *pending_gt = children[1];
+                return;
+            }
+
+            if (static_cast<u_int8_t>(src[start + len]) < static_cast<u_int8_t>(src[pos + len]))
+            {
+                *pending_lt = candidate;
+                pending_lt = &children[1];
+                candidate = *pending_lt;
+                best_lt_len = len;
+            }
+            else
+            {
+                *pending_gt = candidate;
+                pending_gt = &children[0];
+                candidate = *pending_gt;
+                best_gt_len = len;
+            }
         }
+    }
+
+    // цены символов до первого прохода - длины статических кодов
+    void set_static_costs()
+    {
+        for (uint16_t i = 0; i < LIT_LEN_CODES; ++i)
+            lit_cost[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+        for (uint8_t i = 0; i < DIST_CODES; ++i)
+            dist_cost[i] = 5;
+    }
 
-        return code_str;
+    uint32_t get_length_cost(size_t length) const
+    {
+        const LengthCode& code = length_codes[length];
+        return lit_cost[code.symbol] + code.extra_bits;
     }
 
-    string get_length_fixed_code(size_t len)
+    uint32_t get_distance_cost(size_t distance) const
     {
-        auto it = len_table.upper_bound(len);
-        --it;
+        u_int8_t symbol = get_dist_symbol(distance);
+        return dist_cost[symbol] + dist_extra_bits[symbol];
+    }
 
-        u_int16_t base_len = it->first;
-        auto [code, bits, huff] = it->second;
+    // Кратчайший путь по текущим ценам через src[first, first + n) в trial_matches
+    void find_cheapest_path(const string& src, size_t first, size_t n)
+    {
+        path_cost.assign(n + 1, UINT32_MAX);
+        path_choice.resize(n + 1);
+        path_cost[0] = 0;
 
-        string code_str = huff;
-        u_int8_t len_diff = len - base_len;
-        for (u_int8_t i = 0; i < bits; ++i)
+        for (size_t i = 0; i < n; ++i)
         {
-            char bit = ((len_diff >> i) & 1) ? '1' : '0';
-            code_str.push_back(bit);
+            uint32_t cost = path_cost[i];
+
+            uint32_t literal = cost + lit_cost[static_cast<u_int8_t>(src[first + i])];
+            if (literal < path_cost[i + 1])
+            {
+                path_cost[i + 1] = literal;
+                path_choice[i + 1] = {1, 0};
+            }
+
+            // кандидат отвечает за длины от конца предыдущего до своей; совпадения за концом куска укорачиваются
+            size_t len = MIN_MATCH_LEN;
+            for (uint32_t k = candidate_ends[i]; k < candidate_ends[i + 1]; ++k)
+            {
+                const MatchCandidate& candidate = candidates[k];
+                size_t max_len = min<size_t>(candidate.length, n - i);
+                uint32_t dist_cost_here = cost + get_distance_cost(candidate.distance);
+
+                for (; len <= max_len; ++len)
+                {
+                    uint32_t total = dist_cost_here + get_length_cost(len);
+                    if (total < path_cost[i + len])
+                    {
+                        path_cost[i + len] = total;
+                        path_choice[i + len] = {static_cast<uint16_t>(len), candidate.distance};
+                    }
+                }
+            }
         }
 
-        return code_str;
+        // путь восстанавливается с конца
+        trial_matches.clear();
+        for (size_t i = n; i > 0;)
+        {
+            const MatchCandidate& choice = path_choice[i];
+            i -= choice.length;
+            if (choice.distance == 0)
+                trial_matches.emplace_back(0, 1, src[first + i]);
+            else
+                trial_matches.emplace_back(choice.distance, choice.length);
+        }
+        reverse(trial_matches.begin(), trial_matches.end());
     }
 
-    string fixed_huffman_encode(const vector<Match>& matches, size_t& size)
+    // Жадный путь через src[first, first + n) в trial_matches: с каждой позиции самое длинное из
+    // кандидатов, как в обычном режиме, только по дереву
+    void find_longest_path(const string& src, size_t first, size_t n)
     {
-        ostringstream oss;
-
-        oss << BTYPE_FIXED;
-        size += 2;
-
-        for (const Match& match : matches)
+        trial_matches.clear();
+        for (size_t i = 0; i < n;)
         {
-            if (match.distance == 0)
+            size_t len = 0;
+            if (candidate_ends[i + 1] > candidate_ends[i])
+                len = min<size_t>(candidates[candidate_ends[i + 1] - 1].length, n - i);
+
+            if (len >= MIN_MATCH_LEN)
             {
-                string lit_code = get_literal_fixed_code(match.next_char);
-                oss << lit_code;
-                size += lit_code.size();
+                trial_matches.emplace_back(candidates[candidate_ends[i + 1] - 1].distance, len);
+                i += len;
             }
             else
             {
-                string len_code = get_length_fixed_code(match.length);
-                string dist_code = get_distance_fixed_code(match.distance);
-                oss << len_code << dist_code;
-                size += len_code.size() + dist_code.size();
+                trial_matches.emplace_back(0, 1, src[first + i]);
+                ++i;
             }
         }
+    }
 
-        oss << END_OF_BLOCK;
-        size += 7;
-
-        return oss.str();
+    // Размер разбора в битах с его собственными кодами Хаффмана; по его частотам обновляются цены
+    // для следующего прохода (символу, которого не было, достаётся цена как при одном вхождении)
+    size_t update_costs()
+    {
+        vector<uint32_t>& lit_freqs = block_scratch.lit_freqs;
+        vector<uint32_t>& dist_freqs = block_scratch.dist_freqs;
+        HuffmanScratch& scratch = block_scratch.huffman;
+        count_frequencies(trial_matches.data(), trial_matches.size(), lit_freqs, dist_freqs);
+
+        build_code_lengths(lit_freqs, MAX_CODE_BITS, lit_lengths, scratch);
+        build_code_lengths(dist_freqs, MAX_CODE_BITS, dist_lengths, scratch);
+        size_t bits = get_extra_bits(lit_freqs, dist_freqs);
+        for (uint16_t i = 0; i < LIT_LEN_CODES; ++i)
+            bits += lit_freqs[i] * lit_lengths[i];
+        for (uint8_t i = 0; i < DIST_CODES; ++i)
+            bits += dist_freqs[i] * dist_lengths[i];
+
+        for (uint32_t& freq : lit_freqs)
+            freq += (freq == 0);
+        for (uint32_t& freq : dist_freqs)
+            freq += (freq == 0);
+
+        build_code_lengths(lit_freqs, MAX_CODE_BITS, lit_lengths, scratch);
+        build_code_lengths(dist_freqs, MAX_CODE_BITS, dist_lengths, scratch);
+        copy(lit_lengths.begin(), lit_lengths.end(), lit_cost);
+        copy(dist_lengths.begin(), dist_lengths.end(), dist_cost);
+
+        return bits;
     }
 
-    string pack(const string& src)
+    // Оптимальный разбор src[first, last) как в zopfli: сначала для каждой позиции собираются
+    // все совпадения-кандидаты, потом несколько раз ищется кратчайший путь по цене в битах,
+    // и цены каждого следующего прохода берутся из кодов Хаффмана, которые дал предыдущий путь
+    void parse_segment(const string& src, size_t first, size_t last)
     {
-        string packed;
+        size_t n = last - first;
 
-        size_t pos = 0;
-        u_int8_t data = 0;
+        candidates.clear();
+        candidate_ends.resize(n + 1);
+        candidate_ends[0] = 0;
 
-        while (pos < src.size())
+        // внутри совпадения максимальной длины позиции только вставляются в дерево:
+        // более длинного с них не найти, а поиск на длинных повторах дорог
+        size_t skip = 0;
+        for (size_t i = 0; i < n; ++i)
         {
-            if (pos % 8 == 0 && pos != 0)
+            size_t pos = first + i;
+            size_t max_len = min<size_t>(MAX_MATCH_LEN, src.size() - pos);
+            if (max_len >= MIN_MATCH_LEN)
+                insert_tree(src, pos, max_len, skip == 0);
+
+            // совпадения из словаря дописываются после найденных в дереве, только если они длиннее
+            if (dictionary != nullptr && skip == 0 && max_len >= MIN_MATCH_LEN)
             {
-                packed.push_back(data);
-                data = 0;
+                size_t best_len =
+                    (candidates.size() > candidate_ends[i]) ? candidates.back().length : MIN_MATCH_LEN - 1;
+                search_dictionary(src, pos, max_len, best_len,
+                                  [&](size_t length, size_t distance)
+                                  {
+                                      candidates.push_back(
+                                          {static_cast<uint16_t>(length), static_cast<uint16_t>(distance)});
+                                  });
             }
 
-            if (src[pos] == '1')
-                data |= (1 << (pos % 8));
+            if (skip > 0)
+                --skip;
+            else if (candidates.size() > candidate_ends[i] && candidates.back().length == MAX_MATCH_LEN)
+                skip = MAX_MATCH_LEN - 1;
+
+            candidate_ends[i + 1] = candidates.size();
+        }
 
-            ++pos;
+        set_static_costs();
+        size_t best_bits = SIZE_MAX;
+        for (u_int8_t iteration = 0; iteration < OPTIMAL_ITERATIONS; ++iteration)
+        {
+            find_cheapest_path(src, first, n);
+            size_t bits = update_costs();
+            if (bits < best_bits)
+            {
+                best_bits = bits;
+                best_matches.assign(trial_matches.begin(), trial_matches.end());
+            }
         }
-        packed.push_back(data);
 
-        return packed;
+        // цены - лишь оценка, и на длинных повторах кратчайший путь бывает дороже жадного
+        find_longest_path(src, first, n);
+        if (update_costs() < best_bits)
+            best_matches.assign(trial_matches.begin(), trial_matches.end());
+
+        matches.insert(matches.end(), best_matches.begin(), best_matches.end());
     }
 
-   public:
-    string encode(const string& src)
+    void find_optimal_matches(const string& src)
     {
-        // находим все совпадения и переводим исходную строку в вектор Match
-        vector<Match> matches = find_matches(src);
+        matches.clear();
+        for (size_t first = 0; first < src.size(); first += SEGMENT_SIZE)
+            parse_segment(src, first, min(first + SEGMENT_SIZE, src.size()));
+    }
+
+    // Кодирует matches, разбитые на блоки block_ends, и дописывает поток DEFLATE к out, выровняв его до байта.
+    // Каждый блок кодируется тем способом (хранимый, статический или динамический код Хаффмана),
+    // который по оценке даёт меньше бит
+    void write_blocks(const string& src, string& out)
+    {
+        BitWriter writer(out);
 
-        // разбиваем полученный вектор на вектор блоков по длине исходной последовательности
-        vector<vector<Match>> blocks = split_into_blocks(matches);
+        size_t offset = 0;
+        size_t first = 0;
+        for (size_t i = 0; i < block_ends.size(); ++i)
+        {
+            bool is_final = (i + 1 == block_ends.size());
+            size_t last = block_ends[i];
 
-        // cout << "1:\t";
-        // for (const auto& b : blocks)
-        // {
-        //     for (const auto& m : b)
-        //         if (m.distance == 0)
-        //             cout << m.next_char;
-        //         else
-        //             cout << "<" << m.length << "," << m.distance << ">";
-        //     cout << " ";
-        // }
-        // cout << '\n';
+            size_t block_len = 0;
+            for (size_t j = first; j < last; ++j)
+                block_len += matches[j].length;
 
-        // буфер выходной строки
-        ostringstream oss;
+            write_block(writer, matches.data() + first, last - first, src.data() + offset, block_len, is_final,
+                        block_scratch);
 
-        // добавляем в выходную строку заголовок gzip и добавляем блоки
-        oss << "";  // gzip codes
+            offset += block_len;
+            first = last;
+        }
 
-        size_t size = 0;
+        writer.align_to_byte();
+    }
 
-        // каждый блок кодируем статическим кодом Хаффмана
-        for (size_t i = 0; i < blocks.size(); ++i)
+   public:
+    // Предустановленный словарь (как deflateSetDictionary в zlib): образец данных, на который могут
+    // ссылаться совпадения с начала каждого входа. Хранит последние WINDOW_SIZE байт образца и цепочки
+    // хешей по ним, которые строятся один раз и дальше только читаются, так что один словарь можно
+    // разделять между вызовами encode и между Encoder в разных потоках. Распаковщику нужен тот же образец.
+    class Dictionary
+    {
+       private:
+        string data;
+        uint32_t id;  // Adler-32 всего образца, DICTID в заголовке zlib
+        vector<size_t> head;
+        vector<size_t> prev;
+
+        friend class Encoder;
+
+       public:
+        explicit Dictionary(const string& sample)
+            : data(sample.size() > WINDOW_SIZE ? sample.substr(sample.size() - WINDOW_SIZE) : sample),
+              id(adler32_update(1, sample.data(), sample.size())),
+              head(HASH_SIZE, NO_POS),
+              prev(data.size(), NO_POS)
         {
-            char BFINAL = '0';
-            if (i + 1 == blocks.size())
+            for (size_t pos = 0; pos + MIN_MATCH_LEN <= data.size(); ++pos)
             {
-                BFINAL = '1';
+                size_t hash = get_hash(data.data(), pos);
+                prev[pos] = head[hash];
+                head[hash] = pos;
             }
-            oss << BFINAL;
-            ++size;
+        }
+
+        const string& get_data() const { return data; }
+        uint32_t get_id() const { return id; }
+    };
 
-            oss << fixed_huffman_encode(blocks[i], size);
+    explicit Encoder(ParseMode mode = ParseMode::GREEDY)
+        : head(HASH_SIZE, 0), prev(WINDOW_SIZE, 0), base(1), next_base(1), mode(mode), dictionary(nullptr)
+    {
+        if (mode == ParseMode::OPTIMAL)
+        {
+            tree_head.assign(HASH_SIZE, 0);
+            tree_children.assign(2 * WINDOW_SIZE, 0);
         }
+    }
+
+    // Забывает данные прошлых вызовов; выделенная память остаётся
+    void reset() { base = next_base; }
+
+    // Сжимает src в поток DEFLATE в обёртке container, по возможности ссылаясь на словарь dictionary;
+    // результат действителен до следующего вызова encode
+    const string& encode(const string& src, const Dictionary* dictionary = nullptr,
+                         Container container = Container::RAW)
+    {
+        reset();
+        next_base = base + src.size();
+        this->dictionary = dictionary;
+
+        ContainerHeader header;
+        header.has_dict_id = (dictionary != nullptr);
+        header.dict_id = (dictionary != nullptr) ? dictionary->get_id() : 0;
+
+        result.clear();
+        write_container_header(result, container, header);
+        size_t header_len = result.size();
+
+        // находим все совпадения и переводим исходную строку в вектор Match
+        if (mode == ParseMode::OPTIMAL)
+            find_optimal_matches(src);
+        else
+            find_matches(src);
+
+        // разбиваем полученный вектор на блоки по длине исходной последовательности
+        split_into_blocks();
 
-        while (size++ % 8 != 0)
-            oss << '0';
+        write_blocks(src, result);
 
-        // считаем контрольную сумму и добавляем конец
-        oss << "";  // crc-32
+        // оптимальный разбор считает цену по оценке, поэтому весь вход сжимается ещё и обычным разбором
+        // и остаётся более короткий результат: --ultra никогда не хуже обычного режима
+        if (mode == ParseMode::OPTIMAL)
+        {
+            find_matches(src);
+            split_into_blocks();
+
+            alternative.assign(result, 0, header_len);
+            write_blocks(src, alternative);
+            if (alternative.size() < result.size())
+                result.swap(alternative);
+        }
 
-        string result = pack(oss.str());
+        ContainerChecksum checksum(container);
+        checksum.update(src.data(), src.size());
+        write_container_trailer(result, container, checksum.value(), checksum.size());
 
         return result;
     }
@@ -290,12 +595,45 @@ class Encoder
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    // --ultra - оптимальный разбор: дольше, но плотнее; --dict файл - предустановленный словарь;
+    // --zlib, --gzip - обёртка вокруг потока DEFLATE
+    ParseMode mode = ParseMode::GREEDY;
+    Container container = Container::RAW;
+    string dict_name;
+    int i = 1;
+    for (; i < argc - 1; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--ultra")
+            mode = ParseMode::OPTIMAL;
+        else if (arg == "--zlib")
+            container = Container::ZLIB;
+        else if (arg == "--gzip")
+            container = Container::GZIP;
+        else if (arg == "--dict" && i + 2 < argc)
+            dict_name = argv[++i];
+        else
+            return 1;
+    }
+    if (i != argc - 1)
     {
         return 1;
     }
 
-    string file_name = argv[1];
+    string file_name = argv[i];
+
+    unique_ptr<Encoder::Dictionary> dictionary;
+    if (!dict_name.empty())
+    {
+        ifstream dictFile(dict_name);
+        if (!dictFile.is_open())
+        {
+            cerr << "Не удалось открыть файл словаря!" << endl;
+            return 1;
+        }
+        dictionary = make_unique<Encoder::Dictionary>(
+            string((istreambuf_iterator<char>(dictFile)), istreambuf_iterator<char>()));
+    }
 
     ifstream inputFile(file_name);
     if (!inputFile.is_open())
@@ -307,8 +645,17 @@ int main(int argc, char* argv[])
     string src((istreambuf_iterator<char>(inputFile)), istreambuf_iterator<char>());
     inputFile.close();
 
-    Encoder encoder;
-    string encoded = encoder.encode(src);
+    Encoder encoder(mode);
+    string encoded;
+    try
+    {
+        encoded = encoder.encode(src, dictionary.get(), container);
+    }
+    catch (const exception& e)
+    {
+        cerr << "Ошибка при упаковке: " << e.what() << endl;
+        return 1;
+    }
 
     ofstream outputFile(file_name + ".pk");
     if (!outputFile.is_open())
@@ -318,7 +665,10 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    outputFile << encoded << endl;
+    // после сырого потока по-прежнему перевод строки; zlib и gzip пишутся как есть, чтобы их читали другие программы
+    outputFile << encoded;
+    if (container == Container::RAW)
+        outputFile << endl;
 
     outputFile.close();
 
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bit_writer.h"
+#include "crc32.h"
+#include "deflate_block.h"
+#include "deflate_huffman.h"
+#include "deflate_tables.h"
+#include "match_length.h"
+
+// Потоковый кодер DEFLATE с уровнями 1..9 (хеш-цепочки, жадный или ленивый разбор как в zlib).
+// Общий код для gzip_encoder.cpp и индекса gzip_decoder.cpp, который сжимает им окна точек доступа;
+// запись блоков (write_block) использует и Encoder из deflate_pack.cpp.
+
+struct Match
+{
+    size_t distance;
+    size_t length;
+    char next_char;
+
+    Match(size_t d, size_t l) : distance(d), length(l), next_char('\0') {}
+    Match(size_t d, size_t l, char ch) : distance(d), length(l), next_char(ch) {}
+};
+
+constexpr size_t BLOCK_SIZE = 65536;
+constexpr size_t WINDOW_MASK = WINDOW_SIZE - 1;
+constexpr uint8_t HASH_BITS = 15;
+constexpr size_t HASH_SIZE = 1 << HASH_BITS;
+constexpr size_t HASH_MASK = HASH_SIZE - 1;
+constexpr size_t NO_POS = SIZE_MAX;
+constexpr uint8_t MIN_LEVEL = 1;
+constexpr uint8_t MAX_LEVEL = 9;
+constexpr uint8_t DEFAULT_LEVEL = 6;
+constexpr size_t MIN_PROBE_LEN = 4096;          // кусок короче не проверяем на несжимаемость
+constexpr double INCOMPRESSIBLE_ENTROPY = 7.97;  // бит на байт
+constexpr uint8_t PROBE_HASH_BITS = 12;
+
+// Параметры поиска совпадений для уровня сжатия (значения как в zlib)
+struct LevelConfig
+{
+    uint16_t good_length;  // если предыдущее совпадение не короче, цепочку просматриваем вчетверо короче
+    uint16_t max_lazy;     // ленивый режим: не ищем дальше, если совпадение уже такой длины;
+                           // жадный режим: длиннее этого позиции внутри совпадения не индексируем
+    uint16_t nice_length;  // совпадения такой длины достаточно, дальше по цепочке не идём
+    uint16_t max_chain;    // сколько кандидатов из хеш-цепочки проверять на каждой позиции
+    bool lazy;             // откладывать ли совпадение в надежде найти более длинное со следующей позиции
+};
+
+constexpr LevelConfig level_configs[MAX_LEVEL + 1] = {
+    {0, 0, 0, 0, false},           {4, 4, 8, 4, false},       {4, 5, 16, 8, false},
+    {4, 6, 32, 32, false},         {4, 4, 16, 16, true},      {8, 16, 32, 32, true},
+    {8, 16, 128, 128, true},       {8, 32, 128, 256, true},   {32, 128, 258, 1024, true},
+    {32, 258, 258, 4096, true},
+};
+
+// Индекс совпадений по 3-байтовым префиксам: head хранит последнюю позицию с данным хешем,
+// prev (кольцо размером с окно) связывает позиции с одинаковым хешем в цепочку
+struct HashChains
+{
+    std::vector<size_t> head;
+    std::vector<size_t> prev;
+
+    HashChains() : head(HASH_SIZE, NO_POS), prev(WINDOW_SIZE, NO_POS) {}
+};
+
+inline size_t get_hash(const char *buffer, size_t pos)
+{
+    uint8_t b0 = buffer[pos];
+    uint8_t b1 = buffer[pos + 1];
+    uint8_t b2 = buffer[pos + 2];
+    return ((b0 << 10) ^ (b1 << 5) ^ b2) & HASH_MASK;
+}
+
+// buffer - все входные данные подряд, end - их длина
+inline void insert_hash(HashChains &chains, const char *buffer, size_t pos, size_t end)
+{
+    if (pos + MIN_MATCH_LEN > end)
+        return;
+
+    size_t hash = get_hash(buffer, pos);
+    chains.prev[pos & WINDOW_MASK] = chains.head[hash];
+    chains.head[hash] = pos;
+}
+
+// Ищет самое длинное совпадение для pos длиннее prev_len, проходя не более config.max_chain позиций цепочки
+inline size_t find_longest_match(const HashChains &chains, const char *buffer, size_t pos, size_t end,
+                                 const LevelConfig &config, size_t prev_len, size_t &best_match_dist)
+{
+    size_t best_match_len = std::max<size_t>(prev_len, 1);
+    best_match_dist = 0;
+
+    if (pos + MIN_MATCH_LEN > end)
+        return best_match_len;
+
+    size_t max_len = std::min<size_t>(MAX_MATCH_LEN, end - pos);
+    if (best_match_len >= max_len)
+        return best_match_len;
+
+    uint16_t max_chain = config.max_chain;
+    if (prev_len >= config.good_length)
+        max_chain >>= 2;
+
+    size_t start = chains.head[get_hash(buffer, pos)];
+    for (uint16_t chain = 0; chain < max_chain && start != NO_POS && pos - start <= WINDOW_SIZE; ++chain)
+    {
+        // сначала сверяем байт, на котором текущий лучший кандидат обрывается
+        if (best_match_len < MIN_MATCH_LEN || buffer[start + best_match_len] == buffer[pos + best_match_len])
+        {
+            size_t match_len = match_length(buffer + start, buffer + pos, max_len);
+
+            if (match_len >= MIN_MATCH_LEN && match_len > best_match_len)
+            {
+                best_match_len = match_len;
+                best_match_dist = pos - start;
+
+                if (match_len >= std::min<size_t>(config.nice_length, max_len))
+                    break;
+            }
+        }
+
+        start = chains.prev[start & WINDOW_MASK];
+    }
+
+    return best_match_len;
+}
+
+// Рабочие буферы write_block; их память переиспользуется от блока к блоку
+struct BlockScratch
+{
+    std::vector<uint32_t> lit_freqs;
+    std::vector<uint32_t> dist_freqs;
+    DynamicCodes codes;
+    HuffmanScratch huffman;
+};
+
+// Частоты символов block[0, count) и END_OF_BLOCK
+inline void count_frequencies(const Match *block, size_t count, std::vector<uint32_t> &lit_freqs,
+                              std::vector<uint32_t> &dist_freqs)
+{
+    lit_freqs.assign(LIT_LEN_CODES, 0);
+    dist_freqs.assign(DIST_CODES, 0);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &[dist, len, ch] = block[i];
+        if (dist == 0)
+            ++lit_freqs[static_cast<uint8_t>(ch)];
+        else
+        {
+            ++lit_freqs[length_codes[len].symbol];
+            ++dist_freqs[get_dist_symbol(dist)];
+        }
+    }
+    ++lit_freqs[END_OF_BLOCK_CODE];
+}
+
+inline void write_stored_block(BitWriter &writer, const char *data, size_t size, bool is_final)
+{
+    size_t offset = 0;
+    do
+    {
+        size_t len = std::min(size - offset, MAX_STORED_LEN);
+        bool is_last_chunk = (offset + len == size);
+
+        writer.write_bits(is_final && is_last_chunk, 1);
+        writer.write_bits(BTYPE_STORED, 2);
+
+        // LEN и NLEN начинаются с границы байта
+        writer.align_to_byte();
+
+        char header[4] = {
+            static_cast<char>(len & 0xFF),
+            static_cast<char>((len >> 8) & 0xFF),
+            static_cast<char>(~len & 0xFF),
+            static_cast<char>((~len >> 8) & 0xFF),
+        };
+        writer.write_bytes(header, 4);
+        writer.write_bytes(data + offset, len);
+
+        offset += len;
+    } while (offset < size);
+}
+
+// Быстрая проверка перед поиском совпадений: похоже ли, что data[0, len) не сожмётся (сжатые медиа,
+// шифрованные данные). Сначала энтропия нулевого порядка по гистограмме байт: если она заметно меньше
+// 8 бит, выиграет уже код Хаффмана. Иначе считаем позиции, с которых повторяются 4 байта, встреченные
+// раньше в этом же куске: у почти случайных данных их практически нет, и LZ77 тоже ничего не найдёт.
+inline bool is_incompressible(const char *data, size_t len)
+{
+    if (len < MIN_PROBE_LEN)
+        return false;
+
+    uint32_t counts[256] = {};
+    for (size_t i = 0; i < len; ++i)
+        ++counts[static_cast<uint8_t>(data[i])];
+
+    double bits = 0;
+    for (uint32_t count : counts)
+        if (count != 0)
+            bits += count * std::log2(static_cast<double>(len) / count);
+    if (bits < INCOMPRESSIBLE_ENTROPY * len)
+        return false;
+
+    // последняя позиция (+1) с данным хешем 4 байт
+    uint32_t last_seen[1 << PROBE_HASH_BITS] = {};
+    size_t repeats = 0;
+    for (size_t i = 0; i + 4 <= len; ++i)
+    {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        uint32_t hash = (word * 2654435761u) >> (32 - PROBE_HASH_BITS);
+
+        uint32_t seen = last_seen[hash];
+        if (seen != 0 && memcmp(data + seen - 1, data + i, 4) == 0)
+            ++repeats;
+        last_seen[hash] = i + 1;
+    }
+
+    // повторов меньше чем с одной позиции из 64
+    return repeats * 64 < len;
+}
+
+// Символы block[0, count) и END_OF_BLOCK кодами codes (статическими или динамическими)
+inline void write_symbols(BitWriter &writer, const Match *block, size_t count, const BlockCodes &codes)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &[dist, len, ch] = block[i];
+        if (dist == 0)
+        {
+            uint8_t lit = ch;
+            writer.write_bits(codes.lit_codes[lit], codes.lit_lengths[lit]);
+        }
+        else
+        {
+            const LengthCode &len_code = length_codes[len];
+            writer.write_bits(codes.lit_codes[len_code.symbol], codes.lit_lengths[len_code.symbol]);
+            writer.write_bits(len_code.extra, len_code.extra_bits);
+
+            uint8_t dist_symbol = get_dist_symbol(dist);
+            writer.write_bits(codes.dist_codes[dist_symbol], codes.dist_lengths[dist_symbol]);
+            writer.write_bits(dist - dist_base[dist_symbol], dist_extra_bits[dist_symbol]);
+        }
+    }
+
+    writer.write_bits(codes.lit_codes[END_OF_BLOCK_CODE], codes.lit_lengths[END_OF_BLOCK_CODE]);
+}
+
+// Записывает символы block[0, count) тем способом (хранимый, фиксированный или динамический),
+// который даёт меньше бит; data - size исходных байт блока
+inline void write_block(BitWriter &writer, const Match *block, size_t count, const char *data, size_t size,
+                        bool is_final, BlockScratch &scratch)
+{
+    count_frequencies(block, count, scratch.lit_freqs, scratch.dist_freqs);
+    build_dynamic_codes(scratch.lit_freqs, scratch.dist_freqs, scratch.codes, scratch.huffman);
+
+    switch (choose_block_type(scratch.codes, scratch.lit_freqs, scratch.dist_freqs, size, writer.get_bit_shift()))
+    {
+        case BlockType::STORED:
+            write_stored_block(writer, data, size, is_final);
+            break;
+        case BlockType::FIXED:
+            writer.write_bits(is_final, 1);
+            writer.write_bits(BTYPE_FIXED, 2);
+            write_symbols(writer, block, count, get_fixed_codes());
+            break;
+        case BlockType::DYNAMIC:
+            writer.write_bits(is_final, 1);
+            writer.write_bits(BTYPE_DYNAMIC, 2);
+            write_dynamic_header(writer, scratch.codes);
+            write_symbols(writer, block, count, scratch.codes);
+            break;
+    }
+}
+
+// Сжимает data[dict_len, dict_len + len) в поток DEFLATE. Совпадения могут ссылаться и на первые
+// dict_len <= WINDOW_SIZE байт - словарь, который шёл перед этими данными (как deflateSetDictionary в zlib).
+// Если is_last, последний блок помечается финальным; иначе поток заканчивается пустым хранимым блоком,
+// выравнивающим его до границы байта, чтобы к нему можно было дописать следующий. Сжатые байты дописываются
+// в out, crc - CRC-32 сжатых данных.
+inline void deflate_stream(const char *data, size_t dict_len, size_t len, std::string &out, bool is_last,
+                           const LevelConfig &config, uint32_t &crc)
+{
+    // позиции считаются от начала словаря; данные уже целиком в памяти, так что буфер не нужен
+    const char *buffer = data;
+    const size_t end = dict_len + len;
+    size_t pos = dict_len;
+
+    BitWriter writer(out);
+
+    crc = 0;
+
+    // исходные байты блока - buffer[block_start, block_start + block_len)
+    std::vector<Match> block;
+    size_t block_start = pos;
+    size_t block_len = 0;
+    BlockSplitStats split_stats;
+    BlockScratch scratch;
+
+    HashChains chains;
+    for (size_t i = 0; i < dict_len; ++i)
+        insert_hash(chains, buffer, i, end);
+
+    auto advance = [&](size_t count, bool insert)
+    {
+        if (insert)
+            for (size_t i = 0; i < count; ++i)
+                insert_hash(chains, buffer, pos + i, end);
+        pos += count;
+    };
+
+    auto flush_block = [&](bool is_final)
+    {
+        crc = crc32_update(crc, buffer + block_start, block_len);
+        write_block(writer, block.data(), block.size(), buffer + block_start, block_len, is_final, scratch);
+
+        // незаконченные биты остаются в writer, пока поток не кончился
+        if (is_final)
+            writer.align_to_byte();
+
+        block.clear();
+        block_start += block_len;
+        block_len = 0;
+        split_stats.reset();
+    };
+
+    // добавляет символ в конец блока (его исходные байты идут сразу за уже покрытыми); блок заканчивается,
+    // когда он вырос до BLOCK_SIZE или когда статистика символов заметно изменилась
+    auto emit = [&](const Match &match)
+    {
+        if (block_len + match.length > BLOCK_SIZE)
+            flush_block(false);
+
+        block.push_back(match);
+        block_len += match.length;
+
+        if (match.distance == 0)
+            split_stats.observe_literal(match.next_char);
+        else
+            split_stats.observe_match(match.length);
+
+        if (split_stats.should_end_block(block_len))
+            flush_block(false);
+    };
+
+    // Каждые MAX_STORED_LEN байт проверяем, стоит ли их сжимать. Несжимаемый кусок сразу уходит
+    // одним хранимым блоком (5 байт заголовка) без поиска совпадений, и его позиции в цепочки не попадают.
+    size_t next_probe = pos;
+    auto store_if_incompressible = [&]() -> bool
+    {
+        if (pos < next_probe)
+            return false;
+
+        size_t count = std::min(MAX_STORED_LEN, end - pos);
+        next_probe = pos + count;
+        if (!is_incompressible(buffer + pos, count))
+            return false;
+
+        if (!block.empty())
+            flush_block(false);
+
+        crc = crc32_update(crc, buffer + pos, count);
+        write_stored_block(writer, buffer + pos, count, false);
+        pos += count;
+        block_start = pos;
+        return true;
+    };
+
+    if (!config.lazy)
+    {
+        // жадный разбор: сразу берём лучшее совпадение с текущей позиции
+        while (pos < end)
+        {
+            if (store_if_incompressible())
+                continue;
+
+            size_t best_match_dist;
+            size_t best_match_len = find_longest_match(chains, buffer, pos, end, config, 0, best_match_dist);
+
+            if (best_match_dist == 0)
+            {
+                // печатаем сам символ
+                emit(Match(0, 1, buffer[pos]));
+                advance(1, true);
+            }
+            else
+            {
+                // кодируем длину и расстояние
+                emit(Match(best_match_dist, best_match_len));
+                advance(best_match_len, best_match_len <= config.max_lazy);
+            }
+        }
+    }
+    else
+    {
+        // ленивый разбор: совпадение с pos - 1 откладываем, пока не убедимся,
+        // что с pos не начинается более длинное
+        bool match_available = false;
+        size_t prev_len = 0;
+        size_t prev_dist = 0;
+
+        while (pos < end)
+        {
+            // перед проверкой отложенный литерал уходит в блок; отложенное совпадение сначала разрешается
+            if (pos >= next_probe && match_available && prev_dist == 0)
+            {
+                emit(Match(0, 1, buffer[pos - 1]));
+                match_available = false;
+                prev_len = 0;
+            }
+            if (!match_available && store_if_incompressible())
+                continue;
+
+            size_t best_match_dist = 0;
+            size_t best_match_len = 1;
+            if (prev_len < config.max_lazy)
+                best_match_len = find_longest_match(chains, buffer, pos, end, config, prev_len, best_match_dist);
+
+            if (prev_dist != 0 && (best_match_dist == 0 || best_match_len <= prev_len))
+            {
+                // отложенное совпадение начинается с pos - 1, сама pos уже внутри него
+                emit(Match(prev_dist, prev_len));
+                advance(prev_len - 1, true);
+
+                match_available = false;
+                prev_len = 0;
+                prev_dist = 0;
+                continue;
+            }
+
+            if (match_available)
+                emit(Match(0, 1, buffer[pos - 1]));
+
+            match_available = true;
+            prev_len = (best_match_dist == 0) ? 0 : best_match_len;
+            prev_dist = best_match_dist;
+            advance(1, true);
+        }
+
+        if (match_available)
+            emit(Match(0, 1, buffer[pos - 1]));
+    }
+
+    // Упаковываем последний блок
+    if (is_last)
+        flush_block(true);
+    else
+    {
+        if (!block.empty())
+            flush_block(false);
+
+        // пустой хранимый блок выравнивает поток до границы байта (Z_SYNC_FLUSH в zlib)
+        write_stored_block(writer, nullptr, 0, false);
+    }
+}
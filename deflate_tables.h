@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Константы формата DEFLATE (RFC 1951) и таблицы символов длин и расстояний, построенные на этапе компиляции.
+// Кодирование длины или расстояния - пара обращений к массивам вместо поиска по map.
+
+constexpr uint16_t MIN_MATCH_LEN = 3;
+constexpr uint16_t MAX_MATCH_LEN = 258;
+constexpr uint16_t MAX_DISTANCE = 32768;
+constexpr size_t WINDOW_SIZE = 32768;
+constexpr uint8_t LENGTH_CODES = 29;
+constexpr uint8_t DIST_CODES = 30;
+constexpr uint16_t FIRST_LENGTH_CODE = 257;
+constexpr uint16_t LIT_LEN_CODES = 286;
+constexpr uint16_t FIXED_LIT_LEN_CODES = 288;
+constexpr uint8_t CODE_LEN_CODES = 19;
+constexpr uint16_t END_OF_BLOCK_CODE = 256;
+constexpr uint8_t MAX_CODE_BITS = 15;
+constexpr uint8_t MAX_CODE_LEN_BITS = 7;
+constexpr uint8_t BTYPE_STORED = 0;
+constexpr uint8_t BTYPE_FIXED = 1;
+constexpr uint8_t BTYPE_DYNAMIC = 2;
+
+// порядок, в котором в заголовке динамического блока идут длины кодов для алфавита длин
+constexpr uint8_t code_len_order[CODE_LEN_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// база и число дополнительных битов для символов длин 257..285 и расстояний 0..29
+constexpr uint16_t length_base[LENGTH_CODES] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr uint8_t length_extra_bits[LENGTH_CODES] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                     2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr uint16_t dist_base[DIST_CODES] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                            33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                            1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr uint8_t dist_extra_bits[DIST_CODES] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,  4,  4,  5,  5,  6,
+                                                 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Символ длины вместе с дополнительными битами
+struct LengthCode
+{
+    uint16_t symbol;
+    uint8_t extra_bits;
+    uint8_t extra;
+};
+
+constexpr std::array<LengthCode, MAX_MATCH_LEN + 1> build_length_codes()
+{
+    std::array<LengthCode, MAX_MATCH_LEN + 1> codes{};
+    for (uint8_t code = 0; code < LENGTH_CODES; ++code)
+    {
+        // у 284 диапазон 227..258, но длина 258 кодируется отдельным символом 285
+        uint16_t last = (code + 1 < LENGTH_CODES) ? length_base[code + 1] : MAX_MATCH_LEN + 1;
+        for (uint16_t len = length_base[code]; len < last; ++len)
+            codes[len] = {static_cast<uint16_t>(FIRST_LENGTH_CODE + code), length_extra_bits[code],
+                          static_cast<uint8_t>(len - length_base[code])};
+    }
+    return codes;
+}
+
+// Символы расстояний в два уровня, как _dist_code в zlib: первые 256 элементов - для расстояний 1..256,
+// остальные - для больших расстояний по (dist - 1) >> 7
+constexpr std::array<uint8_t, 512> build_dist_symbols()
+{
+    std::array<uint8_t, 512> symbols{};
+    for (uint8_t code = 0; code < DIST_CODES; ++code)
+    {
+        uint32_t last = (code + 1 < DIST_CODES) ? dist_base[code + 1] : MAX_DISTANCE + 1;
+        for (uint32_t dist = dist_base[code]; dist < last; ++dist)
+        {
+            if (dist <= 256)
+                symbols[dist - 1] = code;
+            else
+                symbols[256 + ((dist - 1) >> 7)] = code;
+        }
+    }
+    return symbols;
+}
+
+constexpr std::array<LengthCode, MAX_MATCH_LEN + 1> length_codes = build_length_codes();
+constexpr std::array<uint8_t, 512> dist_symbols = build_dist_symbols();
+
+constexpr uint8_t get_dist_symbol(uint16_t dist)
+{
+    return (dist <= 256) ? dist_symbols[dist - 1] : dist_symbols[256 + ((dist - 1) >> 7)];
+}
+
+static_assert(length_codes[3].symbol == 257 && length_codes[258].symbol == 285 && length_codes[257].extra == 30);
+static_assert(get_dist_symbol(1) == 0 && get_dist_symbol(257) == 16 && get_dist_symbol(32768) == 29);
@@ -1,196 +1,174 @@
 #include <algorithm>
-#include <bitset>
-#include <cassert>
 #include <fstream>
 #include <iostream>
-#include <map>
-#include <sstream>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
-#include <vector>
 
-using namespace std;
-
-struct Match {
-  size_t distance;
-  size_t length;
-  char next_char;
+#include "bit_reader.h"
+#include "deflate_container.h"
+#include "huffman_decoder.h"
+#include "inflate_block.h"
+#include "lz77_copy.h"
 
-  Match(size_t d, size_t l) : distance(d), length(l), next_char('\0') {}
-  Match(size_t d, size_t l, char ch) : distance(d), length(l), next_char(ch) {}
-};
+using namespace std;
 
+// Распаковка сырого потока DEFLATE из deflate_pack. Контекст хранит декодеры кодов Хаффмана и
+// буфер вывода и переиспользует их от вызова к вызову: после того как буфер дорос до размера
+// данных, decode больше не выделяет память.
 class Decoder {
 private:
-  const string BTYPE_FIXED = "10"; // reverse order for packing
-  const string END_OF_BLOCK = "0000000";
-
-  unordered_map<string, tuple<u_int16_t, u_int8_t, u_int16_t>> len_table = {
-      {"0000001", {257, 0, 3}},    {"0000010", {258, 0, 4}},
-      {"0000011", {259, 0, 5}},    {"0000100", {260, 0, 6}},
-      {"0000101", {261, 0, 7}},    {"0000110", {262, 0, 8}},
-      {"0000111", {263, 0, 9}},    {"0001000", {264, 0, 10}},
-      {"0001001", {265, 1, 11}},   {"0001010", {266, 1, 13}},
-      {"0001011", {267, 1, 15}},   {"0001100", {268, 2, 17}},
-      {"0001101", {269, 2, 21}},   {"0001110", {270, 2, 25}},
-      {"0001111", {271, 2, 29}},   {"0010000", {272, 3, 33}},
-      {"0010001", {273, 3, 41}},   {"0010010", {274, 3, 49}},
-      {"0010011", {275, 3, 57}},   {"0010100", {276, 4, 65}},
-      {"0010101", {277, 4, 81}},   {"0010110", {278, 4, 97}},
-      {"0010111", {279, 4, 113}},  {"11000000", {280, 5, 129}},
-      {"11000001", {281, 5, 161}}, {"11000010", {282, 5, 193}},
-      {"11000011", {283, 5, 225}}, {"11000100", {284, 5, 257}},
-      {"11000101", {285, 0, 258}},
-  };
+  // Окно вывода для inflate_block.h: вся распакованная история остаётся в памяти
+  class Output {
+  private:
+    static constexpr size_t WINDOW_SIZE = 32768; // предел расстояния
 
-  unordered_map<string, tuple<u_int8_t, u_int8_t, u_int16_t>> dist_table = {
-      {"00000", {0, 0, 1}},       {"00001", {1, 0, 2}},
-      {"00010", {2, 0, 3}},       {"00011", {3, 0, 4}},
-      {"00100", {4, 1, 5}},       {"00101", {5, 1, 7}},
-      {"00110", {6, 2, 9}},       {"00111", {7, 2, 13}},
-      {"01000", {8, 3, 17}},      {"01001", {9, 3, 25}},
-      {"01010", {10, 4, 33}},     {"01011", {11, 4, 49}},
-      {"01100", {12, 5, 65}},     {"01101", {13, 5, 97}},
-      {"01110", {14, 6, 129}},    {"01111", {15, 6, 193}},
-      {"10000", {16, 7, 257}},    {"10001", {17, 7, 385}},
-      {"10010", {18, 8, 513}},    {"10011", {19, 8, 769}},
-      {"10100", {20, 9, 1025}},   {"10101", {21, 9, 1537}},
-      {"10110", {22, 10, 2049}},  {"10111", {23, 10, 3073}},
-      {"11000", {24, 11, 4097}},  {"11001", {25, 11, 6145}},
-      {"11010", {26, 12, 8193}},  {"11011", {27, 12, 12289}},
-      {"11100", {28, 13, 16385}}, {"11101", {29, 13, 24577}},
-  };
+    string buffer; // словарь, распакованные байты и запас для copy_match за их концом
+    size_t pos = 0;
+    size_t dict_len = 0;
 
-  unordered_map<string, char> lit_table;
+    void reserve(size_t len) {
+      size_t needed = pos + len + MATCH_COPY_PADDING;
+      if (needed > buffer.size())
+        buffer.resize(max({needed, 2 * buffer.size(), buffer.capacity()}));
+    }
 
-  void fill_lit_codes() {
-    lit_table.clear();
+  public:
+    void clear() { pos = dict_len = 0; }
 
-    for (u_int8_t i = 0; i < 144; ++i) {
-      string code = bitset<8>(0x30 + i).to_string();
-      lit_table[code] = static_cast<char>(i);
+    // Кладёт перед выводом последние WINDOW_SIZE байт словаря, на которые могут ссылаться совпадения
+    void prime(const string &dictionary) {
+      dict_len = min(dictionary.size(), WINDOW_SIZE);
+      reserve(dict_len);
+      copy(dictionary.end() - dict_len, dictionary.end(), buffer.begin());
+      pos = dict_len;
     }
 
-    for (u_int16_t i = 144; i < 256; ++i) {
-      string code = bitset<9>(0x190 + (i - 144)).to_string();
-      lit_table[code] = static_cast<char>(i);
+    void put(char ch) {
+      reserve(1);
+      buffer[pos++] = ch;
     }
-  }
 
-  string unpack(const string &src) {
-    string unpacked;
+    void put_match(size_t dist, size_t len) {
+      if (dist > pos)
+        throw runtime_error("invalid distance too far back");
 
-    for (auto ch : src)
-      for (u_int8_t i = 0; i < 8; ++i)
-        if (ch & (1 << i))
-          unpacked.push_back('1');
-        else
-          unpacked.push_back('0');
-
-    return unpacked;
-  }
-
-  size_t get_distance(const string &src, size_t &pos) {
-    auto [_, extra_bits, dist] = dist_table[src.substr(pos, 5)];
-    pos += 5;
-
-    for (size_t i = 0; i < extra_bits; ++i)
-      if (src[pos + i] == '1')
-        dist += (1 << i);
-
-    pos += extra_bits;
-
-    return dist;
-  }
-
-  Match get_match(const string &src, size_t &pos, u_int8_t huff_len) {
-    auto [_, extra_bits, len] = len_table[src.substr(pos, huff_len)];
-    pos += 7;
-
-    for (size_t i = 0; i < extra_bits; ++i)
-      if (src[pos + i] == '1')
-        len += (1 << i);
+      reserve(len);
+      copy_match(&buffer[pos], dist, len);
+      pos += len;
+    }
 
-    pos += extra_bits;
+    void copy_stored(BitReader &reader, size_t len) {
+      reserve(len);
+      reader.read_bytes(reinterpret_cast<uint8_t *>(&buffer[pos]), len);
+      pos += len;
+    }
 
-    size_t dist = get_distance(src, pos);
+    // Обрезает словарь и запас и отдаёт распакованные байты; память буфера при этом остаётся
+    const string &finish() {
+      buffer.resize(pos);
+      buffer.erase(0, dict_len);
+      return buffer;
+    }
+  };
 
-    return Match(dist, len);
-  }
+  HuffmanDecoder lit_decoder;
+  HuffmanDecoder dist_decoder;
+  HuffmanDecoder code_len_decoder;
+  Output output;
 
-  vector<Match> get_matches(const string &src) {
-    vector<Match> matches;
+public:
+  // Забывает результат прошлого вызова, сохраняя выделенную память
+  void reset() { output.clear(); }
+
+  // Распаковывает src в обёртке container, сжатый со словарём dictionary
+  // (пустой - без словаря); результат действителен до следующего вызова decode
+  const string &decode(const string &src, const string &dictionary = string(),
+                       Container container = Container::RAW) {
+    reset();
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(src.data());
+    ContainerHeader header;
+    size_t header_len =
+        read_container_header(data, src.size(), container, header);
+
+    // zlib сам говорит, нужен ли словарь, и проверяет, тот ли он
+    if (container == Container::ZLIB && header.has_dict_id) {
+      if (dictionary.empty())
+        throw runtime_error("missing preset dictionary");
+      if (adler32_update(1, dictionary.data(), dictionary.size()) !=
+          header.dict_id)
+        throw runtime_error("preset dictionary mismatch");
+    }
+    if (!dictionary.empty() &&
+        (container == Container::RAW || header.has_dict_id))
+      output.prime(dictionary);
 
-    size_t pos = 0;
+    BitReader reader(data + header_len, src.size() - header_len);
 
     bool is_final_block;
-    string btype;
-    string huff_code;
     do {
-      is_final_block = (src[pos] == '1');
-      pos += 1;
-      btype = src.substr(pos, 2);
-      pos += 2;
-
-      while (src.substr(pos, 7) != END_OF_BLOCK) {
-        if (len_table.find(src.substr(pos, 7)) != len_table.end()) {
-          Match match = get_match(src, pos, 7);
-          matches.push_back(match);
-        } else if (lit_table.find(src.substr(pos, 8)) != lit_table.end()) {
-          matches.emplace_back(0, 1, lit_table[src.substr(pos, 8)]);
-          pos += 8;
-        } else if (len_table.find(src.substr(pos, 8)) != len_table.end()) {
-          Match match = get_match(src, pos, 8);
-          matches.push_back(match);
-        } else if (lit_table.find(src.substr(pos, 9)) != lit_table.end()) {
-          matches.emplace_back(0, 1, lit_table[src.substr(pos, 9)]);
-          pos += 9;
-        }
+      is_final_block = reader.read_bits(1);
+      uint8_t btype = reader.read_bits(2);
+
+      switch (btype) {
+      case BTYPE_STORED:
+        inflate_stored_block(reader, output);
+        break;
+      case BTYPE_FIXED:
+        inflate_huffman_block(reader, output, get_fixed_lit_decoder(),
+                              get_fixed_dist_decoder());
+        break;
+      case BTYPE_DYNAMIC:
+        read_dynamic_decoders(reader, lit_decoder, dist_decoder,
+                              code_len_decoder);
+        inflate_huffman_block(reader, output, lit_decoder, dist_decoder);
+        break;
+      default:
+        throw runtime_error("invalid deflate block type");
       }
-
-      pos += 7;
-
     } while (!is_final_block);
 
-    return matches;
-  }
-
-public:
-  Decoder() { fill_lit_codes(); }
-
-  string decode(const string &src) {
-    string bits = unpack(src);
-
-    // read gzip header
-    // string header = src.substr(pos, 8);
-    // string footer = src. substr(src.size()-8, 8);
-    // string deflate_str = src.substr(8, src.size() - 16);
-
-    string deflate_str = bits;
+    const string &decoded = output.finish();
 
-    vector<Match> matches = get_matches(deflate_str);
-
-    string result;
-    for (auto [dist, len, ch] : matches) {
-      if (dist == 0)
-        result.push_back(ch);
-      else {
-        size_t start = result.size() - dist;
-        for (size_t i = 0; i < len; ++i)
-          result.push_back(result[start + i % dist]);
-      }
-    }
+    reader.align_to_byte();
+    size_t trailer_pos = header_len + reader.get_bit_position() / 8;
+    ContainerChecksum checksum(container);
+    checksum.update(decoded.data(), decoded.size());
+    check_container_trailer(data + trailer_pos, src.size() - trailer_pos,
+                            container, checksum);
 
-    return result;
+    return decoded;
   }
 };
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  // --dict файл - словарь, с которым файл был упакован;
+  // --zlib, --gzip - обёртка вокруг потока DEFLATE
+  string dictionary;
+  Container container = Container::RAW;
+  int i = 1;
+  for (; i < argc - 1; ++i) {
+    string arg = argv[i];
+    if (arg == "--zlib")
+      container = Container::ZLIB;
+    else if (arg == "--gzip")
+      container = Container::GZIP;
+    else if (arg == "--dict" && i + 2 < argc) {
+      ifstream dictFile(argv[++i]);
+      if (!dictFile.is_open()) {
+        cerr << "Не удалось открыть файл словаря!" << endl;
+        return 1;
+      }
+      dictionary.assign(istreambuf_iterator<char>(dictFile),
+                        istreambuf_iterator<char>());
+    } else
+      return 1;
+  }
+  if (i != argc - 1) {
     return 1;
   }
 
-  string file_name = argv[1];
+  string file_name = argv[i];
 
   ifstream inputFile(file_name);
   if (!inputFile.is_open()) {
@@ -203,7 +181,13 @@ int main(int argc, char *argv[]) {
   inputFile.close();
 
   Decoder decoder;
-  string decoded = decoder.decode(src);
+  string decoded;
+  try {
+    decoded = decoder.decode(src, dictionary, container);
+  } catch (const exception &e) {
+    cerr << "Ошибка при распаковке: " << e.what() << endl;
+    return 1;
+  }
 
   string unpack_file_name;
   if (file_name.substr(file_name.size() - 3, 3) == ".pk")
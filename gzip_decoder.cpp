@@ -2,295 +2,725 @@
 #include <bitset>
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "bit_reader.h"
+#include "crc32.h"
+#include "deflate_container.h"
+#include "deflate_stream.h"
+#include "deflate_tables.h"
+#include "huffman_decoder.h"
+#include "inflate_block.h"
+#include "input_source.h"
+#include "lz77_copy.h"
+#include "output_sink.h"
+#include "pipeline.h"
+
 using namespace std;
 
-struct Match
+// кусок вывода в несколько МиБ, чтобы его CRC можно было раздать по ядрам (Crc32Pool)
+constexpr size_t OUT_CHUNK_SIZE = 4 * CRC32_PARALLEL_MIN_CHUNK;
+// блок BGZF распаковывается не больше чем в 64 КиБ
+constexpr size_t BGZF_CHUNK_SIZE = 1 << 16;
+
+// Буфер вывода: WINDOW_SIZE байт истории, на которую ссылаются совпадения, и за ними кусок
+// новых байт. Распаковка идёт подряд без деления по модулю; когда новые байты заполняют свою часть,
+// они вместе с CRC-32 уходят в выходной поток, а последние 32 КиБ переносятся в начало буфера.
+// Памяти нужно столько же при любом размере файла.
+class OutputWindow
 {
-    size_t distance;
-    size_t length;
-    char next_char;
+   private:
+    ostream &out;
+    size_t flush_pos;   // WINDOW_SIZE + размер куска вывода
+    vector<char> data;  // с запасом на одно совпадение после flush_pos и на выход копирования за его конец
+    size_t pos;         // куда пишется следующий байт
+    size_t start;           // первый ещё не записанный в out байт
+    uint64_t flushed;       // сколько байт уже записано в out
+    uint64_t member_start;  // сколько из них приходится на предыдущие члены gzip
+    uint32_t crc;
+    Crc32Pool *crc_pool;    // потоки для CRC крупных кусков; nullptr - считать в текущем потоке
+
+    void flush()
+    {
+        crc = crc_pool ? crc_pool->update(crc, data.data() + start, pos - start)
+                       : crc32_update(crc, data.data() + start, pos - start);
+        out.write(data.data() + start, pos - start);
+        flushed += pos - start;
+        start = pos;
+    }
 
-    Match(size_t d, size_t l) : distance(d), length(l), next_char('\0') {}
-    Match(size_t d, size_t l, char ch) : distance(d), length(l), next_char(ch) {}
-};
+    void slide()
+    {
+        flush();
+        memmove(data.data(), data.data() + pos - WINDOW_SIZE, WINDOW_SIZE);
+        pos = start = WINDOW_SIZE;
+    }
 
-const string BTYPE_FIXED = "10";
-const string END_OF_BLOCK = "0000000";
-constexpr uint32_t BUF_SIZE = 65536;
-constexpr uint8_t BYTE_SIZE = 8;
-
-constexpr uint16_t LITERAL_CODE_OFFSET_1 = 0x30;
-constexpr uint16_t LITERAL_CODE_OFFSET_2 = 0x190;
-constexpr uint16_t LITERAL_THRESHOLD = 144;
-
-unordered_map<string, tuple<uint16_t, uint8_t, uint16_t>> len_table = {
-    {"0000001", {257, 0, 3}},    {"0000010", {258, 0, 4}},    {"0000011", {259, 0, 5}},    {"0000100", {260, 0, 6}},
-    {"0000101", {261, 0, 7}},    {"0000110", {262, 0, 8}},    {"0000111", {263, 0, 9}},    {"0001000", {264, 0, 10}},
-    {"0001001", {265, 1, 11}},   {"0001010", {266, 1, 13}},   {"0001011", {267, 1, 15}},   {"0001100", {268, 2, 17}},
-    {"0001101", {269, 2, 21}},   {"0001110", {270, 2, 25}},   {"0001111", {271, 2, 29}},   {"0010000", {272, 3, 33}},
-    {"0010001", {273, 3, 41}},   {"0010010", {274, 3, 49}},   {"0010011", {275, 3, 57}},   {"0010100", {276, 4, 65}},
-    {"0010101", {277, 4, 81}},   {"0010110", {278, 4, 97}},   {"0010111", {279, 4, 113}},  {"11000000", {280, 5, 129}},
-    {"11000001", {281, 5, 161}}, {"11000010", {282, 5, 193}}, {"11000011", {283, 5, 225}}, {"11000100", {284, 5, 257}},
-    {"11000101", {285, 0, 258}},
-};
+   public:
+    explicit OutputWindow(ostream &out, size_t chunk_size = OUT_CHUNK_SIZE, Crc32Pool *crc_pool = nullptr)
+        : out(out), flush_pos(WINDOW_SIZE + chunk_size), data(flush_pos + MAX_MATCH_LEN + MATCH_COPY_PADDING), pos(0),
+          start(0), flushed(0), member_start(0), crc(0), crc_pool(crc_pool)
+    {
+    }
 
-unordered_map<string, tuple<uint8_t, uint8_t, uint16_t>> dist_table = {
-    {"00000", {0, 0, 1}},       {"00001", {1, 0, 2}},       {"00010", {2, 0, 3}},      {"00011", {3, 0, 4}},
-    {"00100", {4, 1, 5}},       {"00101", {5, 1, 7}},       {"00110", {6, 2, 9}},      {"00111", {7, 2, 13}},
-    {"01000", {8, 3, 17}},      {"01001", {9, 3, 25}},      {"01010", {10, 4, 33}},    {"01011", {11, 4, 49}},
-    {"01100", {12, 5, 65}},     {"01101", {13, 5, 97}},     {"01110", {14, 6, 129}},   {"01111", {15, 6, 193}},
-    {"10000", {16, 7, 257}},    {"10001", {17, 7, 385}},    {"10010", {18, 8, 513}},   {"10011", {19, 8, 769}},
-    {"10100", {20, 9, 1025}},   {"10101", {21, 9, 1537}},   {"10110", {22, 10, 2049}}, {"10111", {23, 10, 3073}},
-    {"11000", {24, 11, 4097}},  {"11001", {25, 11, 6145}},  {"11010", {26, 12, 8193}}, {"11011", {27, 12, 12289}},
-    {"11100", {28, 13, 16385}}, {"11101", {29, 13, 24577}},
-};
+    // Заполняет историю до начала распаковки (окно из точки индекса); сами эти байты не выводятся
+    void set_history(const char *history, size_t len)
+    {
+        len = min<size_t>(len, WINDOW_SIZE);
+        memcpy(data.data(), history, len);
+        pos = start = len;
+    }
 
-unordered_map<string, char> lit_table;
+    // Последние байты вывода, на которые могут ссылаться следующие совпадения
+    string get_history() const
+    {
+        size_t len = min<size_t>(pos, WINDOW_SIZE);
+        return string(data.data() + pos - len, len);
+    }
 
-void fill_lit_codes()
-{
-    lit_table.clear();
+    void put(char ch)
+    {
+        data[pos++] = ch;
+        if (pos >= flush_pos)
+            slide();
+    }
 
-    for (uint8_t i = 0; i < LITERAL_THRESHOLD; ++i)
+    void put_match(size_t dist, size_t len)
     {
-        string code = bitset<8>(LITERAL_CODE_OFFSET_1 + i).to_string();
-        lit_table[code] = static_cast<char>(i);
+        // в начале буфера всегда вся доступная история, так что pos - это и предел расстояния
+        if (dist > pos)
+            throw runtime_error("invalid distance too far back");
+
+        copy_match(data.data() + pos, dist, len);
+        pos += len;
+        if (pos >= flush_pos)
+            slide();
     }
 
-    for (uint16_t i = LITERAL_THRESHOLD; i < 256; ++i)
+    // Копирует len байт хранимого блока прямо из reader в буфер
+    void copy_stored(BitReader &reader, size_t len)
     {
-        string code = bitset<9>(LITERAL_CODE_OFFSET_2 + (i - LITERAL_THRESHOLD)).to_string();
-        lit_table[code] = static_cast<char>(i);
+        while (len > 0)
+        {
+            size_t count = min(len, flush_pos - pos);
+            reader.read_bytes(reinterpret_cast<uint8_t *>(data.data()) + pos, count);
+            pos += count;
+            len -= count;
+
+            if (pos >= flush_pos)
+                slide();
+        }
     }
-}
 
-size_t get_distance(const string &src, size_t &pos)
+    // Дописывает в out остаток буфера; возвращает CRC-32 всех данных
+    uint32_t finish()
+    {
+        flush();
+        out.flush();
+        return crc;
+    }
+
+    // Заканчивает член gzip в файле из нескольких членов: возвращает CRC-32 и размер его данных
+    // и начинает считать их для следующего
+    uint32_t finish_member(uint64_t &member_size)
+    {
+        flush();
+        uint32_t member_crc = crc;
+        member_size = flushed - member_start;
+        member_start = flushed;
+        crc = 0;
+        return member_crc;
+    }
+
+    // Размер распакованных данных; в трейлере gzip он хранится по модулю 2^32
+    uint64_t size() const { return flushed + (pos - start); }
+};
+
+// Вызывается перед заголовком каждого блока; false - остановить распаковку
+using BlockCallback = function<bool(const OutputWindow &)>;
+
+// Распаковывает поток DEFLATE за один проход: символы декодируются прямо из битового потока
+// и сразу попадают в окно вывода. Возвращает false, если распаковку остановил on_block.
+bool inflate(BitReader &reader, OutputWindow &window, const BlockCallback &on_block = nullptr)
 {
-    auto [_, extra_bits, dist] = dist_table[src.substr(pos, 5)];
-    pos += 5;
+    // таблицы динамических кодов перестраиваются на месте для каждого блока
+    HuffmanDecoder lit_decoder;
+    HuffmanDecoder dist_decoder;
+    HuffmanDecoder code_len_decoder;
+
+    bool is_final_block;
+    do
+    {
+        if (on_block && !on_block(window))
+            return false;
+
+        is_final_block = reader.read_bits(1);
+        uint8_t btype = reader.read_bits(2);
 
-    for (size_t i = 0; i < extra_bits; ++i)
-        if (src[pos + i] == '1')
-            dist += (1 << i);
+        switch (btype)
+        {
+            case BTYPE_STORED:
+                inflate_stored_block(reader, window);
+                break;
+            case BTYPE_FIXED:
+                inflate_huffman_block(reader, window, get_fixed_lit_decoder(), get_fixed_dist_decoder());
+                break;
+            case BTYPE_DYNAMIC:
+                read_dynamic_decoders(reader, lit_decoder, dist_decoder, code_len_decoder);
+                inflate_huffman_block(reader, window, lit_decoder, dist_decoder);
+                break;
+            default:
+                throw runtime_error("invalid deflate block type");
+        }
 
-    pos += extra_bits;
+    } while (!is_final_block);
 
-    return dist;
+    return true;
 }
 
-Match get_match(const string &src, size_t &pos, uint8_t huff_len)
+// Заголовок члена gzip и сколько байт он занял
+struct MemberHeader : ContainerHeader
 {
-    auto [_, extra_bits, len] = len_table[src.substr(pos, huff_len)];
-    pos += 7;
+    size_t header_len = 0;
+};
 
-    for (size_t i = 0; i < extra_bits; ++i)
-        if (src[pos + i] == '1')
-            len += (1 << i);
+// Читает заголовок члена gzip с выровненной позиции reader
+void read_header(BitReader &reader, MemberHeader &header)
+{
+    header.header_len = read_gzip_header([&reader](uint8_t *out, size_t len) { reader.read_bytes(out, len); }, header);
+}
 
-    pos += extra_bits;
+// Читает трейлер gzip, который идёт сразу за последним блоком с границы байта, и сверяет с ним
+// CRC-32 и размер распакованных данных члена
+void check_trailer(BitReader &reader, uint32_t crc, uint64_t size)
+{
+    uint32_t isize = static_cast<uint32_t>(size);
 
-    size_t dist = get_distance(src, pos);
+    uint8_t trailer[8];
+    reader.align_to_byte();
+    reader.read_bytes(trailer, 8);
 
-    return Match(dist, len);
+    uint32_t input_crc = 0;
+    uint32_t input_isize = 0;
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        input_crc |= uint32_t(trailer[i]) << (i * 8);
+        input_isize |= uint32_t(trailer[4 + i]) << (i * 8);
+    }
+
+    if (crc != input_crc)
+        throw runtime_error("crc32 mismatch");
+    if (isize != input_isize)
+        throw runtime_error("length mismatch");
 }
 
-string unpack(const string &src)
+void decode_member(BitReader &reader, ostream &out, size_t chunk_size = OUT_CHUNK_SIZE,
+                   Crc32Pool *crc_pool = nullptr)
 {
-    string unpacked;
-
-    for (auto ch : src)
-        for (uint8_t i = 0; i < 8; ++i)
-            if (ch & (1 << i))
-                unpacked.push_back('1');
-            else
-                unpacked.push_back('0');
+    OutputWindow window(out, chunk_size, crc_pool);
 
-    return unpacked;
+    inflate(reader, window);
+    uint32_t crc = window.finish();
+    check_trailer(reader, crc, window.size());
 }
 
-vector<Match> get_matches(const string &src)
+// Член BGZF, отданный пулу распаковки, и обещание результата, которого по порядку ждёт decode
+struct InflateJob
 {
-    vector<Match> matches;
+    vector<uint8_t> member;
+    promise<string> result;
+};
 
-    size_t pos = 0;
+string decode_bgzf_member(const vector<uint8_t> &member)
+{
+    BitReader member_reader(member.data(), member.size());
+    ostringstream member_out;
+    decode_member(member_reader, member_out, BGZF_CHUNK_SIZE);
+    return member_out.str();
+}
 
-    bool is_final_block;
-    string btype;
-    string huff_code;
-    do
+// Распаковывает все члены файла подряд, начиная с уже прочитанного заголовка header.
+// Обычный член декодируется потоком прямо в out. Для члена BGZF размер известен из заголовка,
+// поэтому его байты читаются целиком и, как куски при сжатии с -p, отдаются пулу из threads
+// постоянных рабочих потоков; в работе не больше threads членов, а результаты записываются по порядку.
+void decode(BitReader &reader, ostream &out, MemberHeader header, unsigned threads)
+{
+    deque<future<string>> pending;
+    BoundedQueue<InflateJob> jobs(threads);
+    Crc32Pool crc_pool(threads);
+    vector<future<void>> workers;
+
+    auto write_pending = [&](size_t keep)
     {
-        is_final_block = (src[pos] == '1');
-        pos += 1;
-        btype = src.substr(pos, 2);
-        pos += 2;
+        while (pending.size() > keep)
+        {
+            string data = pending.front().get();
+            out.write(data.data(), data.size());
+            pending.pop_front();
+        }
+    };
 
-        while (src.substr(pos, 7) != END_OF_BLOCK)
+    // рабочие потоки запускаются на первом члене BGZF и живут до конца файла; ошибку члена получит decode
+    auto start_workers = [&]
+    {
+        for (unsigned i = 0; i < threads; ++i)
+            workers.push_back(async(launch::async,
+                                    [&jobs]
+                                    {
+                                        InflateJob job;
+                                        while (jobs.pop(job))
+                                        {
+                                            try
+                                            {
+                                                job.result.set_value(decode_bgzf_member(job.member));
+                                            }
+                                            catch (...)
+                                            {
+                                                job.result.set_exception(current_exception());
+                                            }
+                                        }
+                                    }));
+    };
+
+    try
+    {
+        while (true)
         {
-            if (len_table.find(src.substr(pos, 7)) != len_table.end())
+            if (header.block_size != 0)
             {
-                Match match = get_match(src, pos, 7);
-                matches.push_back(match);
+                InflateJob job;
+                job.member.resize(header.block_size - header.header_len);
+                reader.read_bytes(job.member.data(), job.member.size());
+
+                write_pending(threads - 1);
+                if (threads == 1)
+                    job.result.set_value(decode_bgzf_member(job.member));
+
+                pending.push_back(job.result.get_future());
+                if (threads > 1)
+                {
+                    if (workers.empty())
+                        start_workers();
+                    jobs.push(move(job));
+                }
             }
-            else if (lit_table.find(src.substr(pos, 8)) != lit_table.end())
-            {
-                matches.emplace_back(0, 1, lit_table[src.substr(pos, 8)]);
-                pos += 8;
-            }
-            else if (len_table.find(src.substr(pos, 8)) != len_table.end())
-            {
-                Match match = get_match(src, pos, 8);
-                matches.push_back(match);
-            }
-            else if (lit_table.find(src.substr(pos, 9)) != lit_table.end())
+            else
             {
-                matches.emplace_back(0, 1, lit_table[src.substr(pos, 9)]);
-                pos += 9;
+                write_pending(0);
+                decode_member(reader, out, OUT_CHUNK_SIZE, &crc_pool);
             }
+
+            if (reader.is_end())
+                break;
+            read_header(reader, header);
         }
 
-        pos += 7;
+        write_pending(0);
+    }
+    catch (...)
+    {
+        // рабочие ждут новых членов, пока очередь не закрыта
+        jobs.close();
+        throw;
+    }
 
-    } while (!is_final_block);
+    jobs.close();
+    for (future<void> &worker : workers)
+        worker.get();
+    out.flush();
+}
 
-    return matches;
+// Точка произвольного доступа (как в zran из примеров zlib): начало блока DEFLATE, с которого
+// можно распаковывать, зная лишь последние 32 КиБ вывода перед ним
+struct Checkpoint
+{
+    uint64_t out_offset;  // сколько байт распаковано до точки
+    uint64_t bit_offset;  // позиция заголовка блока в сжатом файле, в битах
+    string window;        // до WINDOW_SIZE байт вывода перед точкой
+};
+
+// Формат файла индекса, все числа little-endian:
+// "GZIDX002", размер сжатого файла (8), шаг (8), число точек (8),
+// затем для каждой точки out_offset (8), bit_offset (8), длина окна (2), его CRC-32 (4),
+// длина сжатого окна (4) и само окно, сжатое в сырой поток DEFLATE (как окна в zran)
+constexpr char INDEX_MAGIC[8] = {'G', 'Z', 'I', 'D', 'X', '0', '0', '2'};
+constexpr uint64_t DEFAULT_INDEX_SPAN_MB = 1;
+
+void write_uint(ostream &out, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; ++i)
+        out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
 }
 
-void generate_crc32_table(uint32_t table[256])
+uint64_t read_uint(istream &in, uint8_t bytes)
 {
-    for (uint32_t i = 0; i < 256; ++i)
-    {
-        uint32_t crc = i;
-        for (int j = 0; j < 8; ++j)
-        {
-            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
-        }
-        table[i] = crc;
-    }
+    uint8_t buffer[8];
+    if (!in.read(reinterpret_cast<char *>(buffer), bytes))
+        throw runtime_error("truncated index");
+
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < bytes; ++i)
+        value |= uint64_t(buffer[i]) << (8 * i);
+    return value;
 }
 
-void read_header(istream &in, string &filename)
+// Строит индекс за одну полную распаковку с уже прочитанного первого заголовка; вывод никуда
+// не пишется, но CRC каждого члена проверяется. Точка ставится в начале блока, если с прошлой
+// распаковано не меньше span байт. compressed_size - сколько байт занял весь файл; CRC считается
+// в threads потоках.
+vector<Checkpoint> build_index(BitReader &reader, uint64_t span, uint64_t &compressed_size, unsigned threads)
 {
-    char buffer[BUF_SIZE];
-    in.read(buffer, 10);
+    vector<Checkpoint> index;
+
+    ostream null_out(nullptr);
+    Crc32Pool crc_pool(threads);
+    OutputWindow window(null_out, OUT_CHUNK_SIZE, &crc_pool);
 
-    size_t pos = 10;
-    if ((buffer[3] & (1 << 3)) != 0)
+    auto on_block = [&](const OutputWindow &w)
     {
-        filename = "";
-        char symbol;
-        in >> symbol;
-        while (symbol != '\x00')
-        {
-            filename.push_back(symbol);
-            in >> symbol;
-            ++pos;
-        }
+        if (index.empty() || w.size() >= index.back().out_offset + span)
+            index.push_back({w.size(), reader.get_bit_position(), w.get_history()});
+        return true;
+    };
+
+    while (true)
+    {
+        inflate(reader, window, on_block);
+
+        uint64_t member_size;
+        uint32_t crc = window.finish_member(member_size);
+        reader.align_to_byte();
+        check_trailer(reader, crc, member_size);
+
+        if (reader.is_end())
+            break;
+
+        MemberHeader header;
+        read_header(reader, header);
     }
+
+    compressed_size = reader.get_bit_position() / 8;
+    return index;
 }
 
-void decode(istream &in, ostream &out)
+void write_index(ostream &out, uint64_t compressed_size, uint64_t span, const vector<Checkpoint> &index)
 {
-    fill_lit_codes();
-
-    streampos start_pos = in.tellg();
-    in.seekg(0, std::ios::end);
-    streampos end_of_file = in.tellg();
-    size_t bytes_to_read = end_of_file - start_pos - 8;
-    in.seekg(start_pos, std::ios::beg);
-
-    char byte;
-    string src;
-    for (size_t i = 0; i < bytes_to_read; ++i)
-    {
-        in.read(&byte, 1);
-        for (uint8_t j = 0; j < BYTE_SIZE; ++j)
-            if (((byte >> j) & 1) == 1)
-                src.push_back('1');
-            else
-                src.push_back('0');
+    out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    write_uint(out, compressed_size, 8);
+    write_uint(out, span, 8);
+    write_uint(out, index.size(), 8);
+
+    // окна сжимаются тем же кодером, что и в gzip_encoder; индекс пишется один раз, так что уровень наибольший
+    string packed;
+    for (const Checkpoint &point : index)
+    {
+        uint32_t crc;
+        packed.clear();
+        deflate_stream(point.window.data(), 0, point.window.size(), packed, true, level_configs[MAX_LEVEL], crc);
+
+        write_uint(out, point.out_offset, 8);
+        write_uint(out, point.bit_offset, 8);
+        write_uint(out, point.window.size(), 2);
+        write_uint(out, crc, 4);
+        write_uint(out, packed.size(), 4);
+        out.write(packed.data(), packed.size());
     }
+}
 
-    cout << src << '\n';
+// Распаковывает окно точки индекса и сверяет его длину и CRC-32
+string unpack_window(const string &packed, size_t len, uint32_t crc)
+{
+    ostringstream window_out;
+    OutputWindow window(window_out, WINDOW_SIZE);
+    BitReader reader(reinterpret_cast<const uint8_t *>(packed.data()), packed.size());
+    inflate(reader, window);
+
+    if (window.finish() != crc || window.size() != len)
+        throw runtime_error("corrupt index window");
+    return window_out.str();
+}
+
+vector<Checkpoint> read_index(istream &in, uint64_t compressed_size)
+{
+    char magic[sizeof(INDEX_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic), INDEX_MAGIC))
+        throw runtime_error("not a gzip index");
 
-    vector<Match> matches = get_matches(src);
+    if (read_uint(in, 8) != compressed_size)
+        throw runtime_error("index does not match the compressed file");
 
-    string result;
-    for (auto [dist, len, ch] : matches)
+    read_uint(in, 8);
+    vector<Checkpoint> index(read_uint(in, 8));
+    string packed;
+    for (Checkpoint &point : index)
     {
-        if (dist == 0)
-            result.push_back(ch);
-        else
-        {
-            size_t start = result.size() - dist;
-            for (size_t i = 0; i < len; ++i)
-                result.push_back(result[start + i % dist]);
-        }
+        point.out_offset = read_uint(in, 8);
+        point.bit_offset = read_uint(in, 8);
+        size_t window_len = read_uint(in, 2);
+        uint32_t crc = read_uint(in, 4);
+        size_t packed_len = read_uint(in, 4);
+        // сжатое окно не длиннее хранимых блоков с ним самим
+        if (window_len > WINDOW_SIZE || packed_len > 2 * WINDOW_SIZE)
+            throw runtime_error("invalid index");
+
+        packed.resize(packed_len);
+        if (!in.read(&packed[0], packed.size()))
+            throw runtime_error("truncated index");
+
+        point.window = unpack_window(packed, window_len, crc);
     }
 
-    uint32_t input_crc = 0;
-    for (uint8_t i = 0; i < 4; ++i)
+    if (index.empty() || index[0].out_offset != 0)
+        throw runtime_error("invalid index");
+    return index;
+}
+
+// Буфер потока, который отбрасывает первые skip байт и пропускает в out следующие len байт
+class RangeBuf : public streambuf
+{
+   private:
+    ostream &out;
+    uint64_t skip;
+    uint64_t left;
+
+   protected:
+    streamsize xsputn(const char *s, streamsize n) override
     {
-        char data;
-        in.read(&data, 1);
-        input_crc |= ((data & 0xFF) << i * 8);
+        uint64_t skipped = min<uint64_t>(skip, n);
+        skip -= skipped;
+
+        uint64_t count = min<uint64_t>(left, n - skipped);
+        out.write(s + skipped, count);
+        left -= count;
+
+        return n;
     }
 
-    uint32_t input_isize = 0;
-    for (uint8_t i = 0; i < 4; ++i)
+    int_type overflow(int_type ch) override
     {
-        char data;
-        in.read(&data, 1);
-        input_isize |= ((data & 0xFF) << i * 8);
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            char c = traits_type::to_char_type(ch);
+            xsputn(&c, 1);
+        }
+        return ch;
     }
 
-    uint32_t crc_table[256];
-    generate_crc32_table(crc_table);
+   public:
+    RangeBuf(ostream &out, uint64_t skip, uint64_t len) : out(out), skip(skip), left(len) {}
+};
+
+// Пишет в out len байт распакованных данных с позиции offset: переходит к ближайшей точке индекса
+// не дальше offset, восстанавливает окно и распаковывает, пока не наберётся нужное
+void decode_range(InputSource &in, const vector<Checkpoint> &index, uint64_t offset, uint64_t len, ostream &out)
+{
+    auto next = upper_bound(index.begin(), index.end(), offset,
+                            [](uint64_t value, const Checkpoint &point) { return value < point.out_offset; });
+    const Checkpoint &point = *prev(next);
 
-    uint32_t crc = 0xFFFFFFFF;
-    for (size_t i = 0; i < result.size(); ++i)
-        crc = (crc >> 8) ^ crc_table[(crc ^ result[i]) & 0xFF];
+    in.seek(point.bit_offset / 8);
 
-    crc ^= 0xFFFFFFFF;
+    BitReader reader(in);
+    if (point.bit_offset % 8 != 0)
+        reader.read_bits(point.bit_offset % 8);
 
-    cout << result << '\n';
+    RangeBuf range(out, offset - point.out_offset, len);
+    ostream range_out(&range);
 
-    uint32_t isize = result.size();
+    OutputWindow window(range_out);
+    window.set_history(point.window.data(), point.window.size());
 
-    assert(crc == input_crc);
-    assert(isize == input_isize);
+    uint64_t end = offset - point.out_offset + len;
+    auto on_block = [end](const OutputWindow &w) { return w.size() < end; };
 
-    out << result;
+    // член закончился раньше диапазона: пропускаем трейлер и продолжаем со следующего
+    while (inflate(reader, window, on_block))
+    {
+        uint8_t trailer[8];
+        reader.align_to_byte();
+        reader.read_bytes(trailer, 8);
+
+        if (reader.is_end())
+            break;
+
+        MemberHeader header;
+        read_header(reader, header);
+    }
+
+    window.finish();
+    out.flush();
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    bool to_stdout = false;
+    string filename;
+
+    bool index_mode = false;
+    uint64_t span_mb = DEFAULT_INDEX_SPAN_MB;
+    bool range_mode = false;
+    uint64_t range_offset = 0;
+    uint64_t range_len = 0;
+
+    for (int i = 1; i < argc; ++i)
     {
-        cerr << "Передано не верное количество аргументов!" << endl;
-        return 1;
+        string arg = argv[i];
+        if (arg == "-p" && i + 1 < argc)
+        {
+            int value = atoi(argv[++i]);
+            if (value <= 0)
+            {
+                cerr << "Число потоков должно быть положительным: " << argv[i] << endl;
+                return 1;
+            }
+            threads = value;
+        }
+        else if (arg == "--index")
+            index_mode = true;
+        else if (arg == "--span" && i + 1 < argc)
+        {
+            span_mb = strtoull(argv[++i], nullptr, 10);
+            if (span_mb == 0)
+            {
+                cerr << "Шаг индекса должен быть положительным: " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--range" && i + 1 < argc)
+        {
+            // offset:len в байтах распакованных данных
+            string range = argv[++i];
+            size_t colon = range.find(':');
+            char *end = nullptr;
+            if (colon != string::npos)
+            {
+                range_offset = strtoull(range.c_str(), &end, 10);
+                if (end == range.c_str() + colon)
+                    range_len = strtoull(range.c_str() + colon + 1, &end, 10);
+            }
+            if (colon == string::npos || end == nullptr || *end != '\0')
+            {
+                cerr << "Диапазон задаётся как смещение:длина: " << range << endl;
+                return 1;
+            }
+            range_mode = true;
+        }
+        else if (arg.size() > 1 && arg[0] == '-' && arg.find_first_not_of("cd", 1) == string::npos)
+        {
+            // -c, -d и их склейки; распаковка и так единственный режим, -d принимается ради привычного gzip -dc
+            if (arg.find('c') != string::npos)
+                to_stdout = true;
+        }
+        else if (filename.empty() && (arg[0] != '-' || arg == "-"))
+            filename = arg;
+        else
+        {
+            cerr << "Неизвестный аргумент: " << arg << endl;
+            return 1;
+        }
     }
 
-    string filename = argv[1];
+    // без файла (или с "-") распаковываем stdin в stdout, как gzip -dc в конвейере
+    bool from_stdin = filename.empty() || filename == "-";
+    if (from_stdin)
+        to_stdout = true;
+
+    if (from_stdin && (index_mode || range_mode))
+    {
+        cerr << "Для --index и --range нужен файл, а не stdin!" << endl;
+        return 1;
+    }
 
-    ifstream input_file(filename, ios::binary);
-    if (!input_file.is_open())
+    unique_ptr<InputSource> input_file =
+        from_stdin ? make_unique<InputSource>(STDIN_FILENO) : make_unique<InputSource>(filename);
+    if (!input_file->is_open())
     {
         cerr << "Не удалось открыть файл для чтения!" << endl;
         return 1;
     }
 
-    string output_name;
-    read_header(input_file, output_name);
+    BitReader reader(*input_file);
+    MemberHeader header;
+    try
+    {
+        read_header(reader, header);
+    }
+    catch (const exception &e)
+    {
+        cerr << "Ошибка при распаковке: " << e.what() << endl;
+        return 1;
+    }
+
+    string index_name = filename + ".idx";
+
+    if (index_mode)
+    {
+        try
+        {
+            uint64_t compressed_size;
+            vector<Checkpoint> index = build_index(reader, span_mb << 20, compressed_size, threads);
+
+            ofstream index_file(index_name, ios::binary);
+            if (!index_file.is_open())
+            {
+                cerr << "Не удалось открыть файл для записи!" << endl;
+                return 1;
+            }
+            write_index(index_file, compressed_size, span_mb << 20, index);
+            cout << "Индекс записан в " << index_name << ", точек: " << index.size() << endl;
+        }
+        catch (const exception &e)
+        {
+            cerr << "Ошибка при построении индекса: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (range_mode)
+    {
+        try
+        {
+            // без индекса остаётся распаковать с начала: единственная точка - первый блок
+            vector<Checkpoint> index = {{0, reader.get_bit_position(), ""}};
+
+            ifstream index_file(index_name, ios::binary);
+            if (index_file.is_open())
+                index = read_index(index_file, input_file->file_size());
+
+            OutputSink output_file(STDOUT_FILENO);
+            ostream output(&output_file);
+            output.exceptions(ios::badbit);
+            decode_range(*input_file, index, range_offset, range_len, output);
+            output.flush();
+        }
+        catch (const exception &e)
+        {
+            cerr << "Ошибка при распаковке: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    string output_name = header.file_name;
 
-    if (output_name.empty())
+    if (to_stdout)
+        output_name.clear();
+    else if (output_name.empty())
         output_name = filename + ".ungz";
     else
     {
@@ -299,17 +729,28 @@ int main(int argc, char *argv[])
             output_name = filename.substr(0, pos + 1) + output_name;
     }
 
-    ofstream output_file(output_name);
-    if (!output_file.is_open())
+    unique_ptr<OutputSink> output_file =
+        to_stdout ? make_unique<OutputSink>(STDOUT_FILENO) : make_unique<OutputSink>(output_name);
+    if (!output_file->is_open())
     {
         cerr << "Не удалось открыть файл для записи!" << endl;
         return 1;
     }
 
-    decode(input_file, output_file);
-
-    input_file.close();
-    output_file.close();
+    try
+    {
+        // ошибка записи прерывает распаковку, а не теряется в состоянии потока
+        ostream output(output_file.get());
+        output.exceptions(ios::badbit);
+        decode(reader, output, header, threads);
+        output.flush();
+    }
+    catch (const exception &e)
+    {
+        cerr << "Ошибка при распаковке: " << e.what() << endl;
+        return 1;
+    }
 
-    cout << "Файл успешно обработан!" << endl;
+    if (!to_stdout)
+        cout << "Файл успешно обработан!" << endl;
 }
\ No newline at end of file
@@ -3,341 +3,269 @@
 #include <cassert>
 #include <chrono>
 #include <cstdint>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <future>
 #include <iostream>
 #include <map>
-#include <sstream>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "crc32.h"
+#include "deflate_container.h"
+#include "deflate_stream.h"
+#include "input_source.h"
+#include "output_sink.h"
+#include "pipeline.h"
+
 using namespace std;
 
 struct Options
 {
     bool store_filename;
     string file_name;
+    uint8_t level;     // степень сжатия 1..9, как у gzip
+    unsigned threads;  // сколько кусков сжимать одновременно (-p); 1 - обычный однопоточный режим
 };
 
-struct Match
-{
-    size_t distance;
-    size_t length;
-    char next_char;
-
-    Match(size_t d, size_t l) : distance(d), length(l), next_char('\0') {}
-    Match(size_t d, size_t l, char ch) : distance(d), length(l), next_char(ch) {}
-};
-
-constexpr size_t BLOCK_SIZE = 65536;
-constexpr size_t WINDOW_SIZE = 32768;
-constexpr uint16_t MIN_MATCH_LEN = 3;
-constexpr uint16_t MAX_MATCH_LEN = 258;
-constexpr uint8_t BYTE_SIZE = 8;
-constexpr size_t BUF_SIZE = WINDOW_SIZE + MAX_MATCH_LEN;
-const string BTYPE_FIXED = "10";
-const string END_OF_BLOCK = "0000000";
-
-constexpr uint16_t LITERAL_CODE_OFFSET_1 = 0x30;
-constexpr uint16_t LITERAL_CODE_OFFSET_2 = 0x190;
-constexpr uint16_t LITERAL_THRESHOLD = 144;
-
-map<uint16_t, tuple<uint16_t, uint8_t, string>> len_table = {
-    {3, {257, 0, "0000001"}},    {4, {258, 0, "0000010"}},    {5, {259, 0, "0000011"}},    {6, {260, 0, "0000100"}},
-    {7, {261, 0, "0000101"}},    {8, {262, 0, "0000110"}},    {9, {263, 0, "0000111"}},    {10, {264, 0, "0001000"}},
-    {11, {265, 1, "0001001"}},   {13, {266, 1, "0001010"}},   {15, {267, 1, "0001011"}},   {17, {268, 2, "0001100"}},
-    {21, {269, 2, "0001101"}},   {25, {270, 2, "0001110"}},   {29, {271, 2, "0001111"}},   {33, {272, 3, "0010000"}},
-    {41, {273, 3, "0010001"}},   {49, {274, 3, "0010010"}},   {57, {275, 3, "0010011"}},   {65, {276, 4, "0010100"}},
-    {81, {277, 4, "0010101"}},   {97, {278, 4, "0010110"}},   {113, {279, 4, "0010111"}},  {129, {280, 5, "11000000"}},
-    {161, {281, 5, "11000001"}}, {193, {282, 5, "11000010"}}, {225, {283, 5, "11000011"}}, {257, {284, 5, "11000100"}},
-    {258, {285, 0, "11000101"}},
-};
-
-map<uint16_t, tuple<uint8_t, uint8_t, string>> dist_table = {
-    {1, {0, 0, "00000"}},       {2, {1, 0, "00001"}},       {3, {2, 0, "00010"}},      {4, {3, 0, "00011"}},
-    {5, {4, 1, "00100"}},       {7, {5, 1, "00101"}},       {9, {6, 2, "00110"}},      {13, {7, 2, "00111"}},
-    {17, {8, 3, "01000"}},      {25, {9, 3, "01001"}},      {33, {10, 4, "01010"}},    {49, {11, 4, "01011"}},
-    {65, {12, 5, "01100"}},     {97, {13, 5, "01101"}},     {129, {14, 6, "01110"}},   {193, {15, 6, "01111"}},
-    {257, {16, 7, "10000"}},    {385, {17, 7, "10001"}},    {513, {18, 8, "10010"}},   {769, {19, 8, "10011"}},
-    {1025, {20, 9, "10100"}},   {1537, {21, 9, "10101"}},   {2049, {22, 10, "10110"}}, {3073, {23, 10, "10111"}},
-    {4097, {24, 11, "11000"}},  {6145, {25, 11, "11001"}},  {8193, {26, 12, "11010"}}, {12289, {27, 12, "11011"}},
-    {16385, {28, 13, "11100"}}, {24577, {29, 13, "11101"}},
-};
+constexpr size_t CHUNK_SIZE = 128 * 1024;
+constexpr size_t STREAM_CHUNK_SIZE = 1 << 20;
 
-string get_literal_fixed_code(char ch)
+uint32_t get_current_unix_time()
 {
-    size_t code;
-    string result;
-    if (static_cast<uint8_t>(ch) < LITERAL_THRESHOLD)
-    {
-        code = LITERAL_CODE_OFFSET_1 + ch;
-        result = bitset<8>(code).to_string();
-    }
-    else
-    {
-        code = LITERAL_CODE_OFFSET_2 + (ch - LITERAL_THRESHOLD);
-        result = bitset<9>(code).to_string();
-    }
-
-    return result;
+    auto now = chrono::system_clock::now();
+    auto epoch = now.time_since_epoch();
+    auto seconds = chrono::duration_cast<std::chrono::seconds>(epoch);
+    return static_cast<uint32_t>(seconds.count());
 }
 
-string get_distance_fixed_code(uint16_t dist)
+// Кусок входа для сжатия: dict_len байт словаря и за ними len байт данных.
+// Из отображённого файла они берутся на месте, из канала - читаются в owned.
+struct ChunkInput
 {
-    auto it = dist_table.upper_bound(dist);
-    --it;
-
-    uint16_t base_dist = it->first;
-    auto [code, bits, huff] = it->second;
-
-    string code_str = huff;
-    uint16_t dist_diff = dist - base_dist;
-    for (uint8_t i = 0; i < bits; ++i)
-    {
-        char bit = ((dist_diff >> i) & 1) ? '1' : '0';
-        code_str.push_back(bit);
-    }
+    const char *mapped;  // nullptr - данные в owned
+    string owned;
+    size_t dict_len;
+    size_t len;
+    bool is_last;
 
-    return code_str;
-}
+    const char *data() const { return mapped != nullptr ? mapped : owned.data(); }
+};
 
-string get_length_fixed_code(size_t len)
+// Сжатый кусок входа; input - буфер, из которого он сжимался, чтобы вернуть его в пул
+struct Chunk
 {
-    auto it = len_table.upper_bound(len);
-    --it;
-
-    uint16_t base_len = it->first;
-    auto [code, bits, huff] = it->second;
-
-    string code_str = huff;
-    uint8_t len_diff = len - base_len;
-    for (uint8_t i = 0; i < bits; ++i)
-    {
-        char bit = ((len_diff >> i) & 1) ? '1' : '0';
-        code_str.push_back(bit);
-    }
-
-    return code_str;
-}
+    string data;
+    string input;
+    uint32_t crc;
+    uint64_t len;
+};
 
-uint32_t get_current_unix_time()
+// Кусок, отданный пулу сжатия, и обещание результата, которого по порядку ждёт поток записи
+struct CompressJob
 {
-    auto now = chrono::system_clock::now();
-    auto epoch = now.time_since_epoch();
-    auto seconds = chrono::duration_cast<std::chrono::seconds>(epoch);
-    return static_cast<uint32_t>(seconds.count());
-}
+    ChunkInput input;
+    promise<Chunk> result;
+};
 
-void generate_crc32_table(uint32_t table[256])
+// Стадия чтения: режет вход на куски по chunk_size и передаёт их в inputs. Отображённый файл
+// не копируется, но его страницы подгружаются здесь заранее; канал читается в буферы из пула.
+void read_chunks(InputSource &in, size_t chunk_size, BoundedQueue<ChunkInput> &inputs, BufferPool &buffers)
 {
-    for (uint32_t i = 0; i < 256; ++i)
+    if (in.is_mapped())
     {
-        uint32_t crc = i;
-        for (int j = 0; j < 8; ++j)
+        const char *data = reinterpret_cast<const char *>(in.data());
+        size_t start = 0;
+        while (true)
         {
-            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+            size_t dict_len = min(start, WINDOW_SIZE);
+            size_t len = min(chunk_size, in.size() - start);
+            bool is_last = (start + len == in.size());
+
+            in.prefetch(start, len);
+            if (!inputs.push({data + start - dict_len, "", dict_len, len, is_last}) || is_last)
+                return;
+            start += len;
         }
-        table[i] = crc;
     }
-}
 
-void append_binary_data(ostream &out, uint8_t data, uint8_t &byte, uint8_t &bit_shift)
-{
-    for (uint8_t j = BYTE_SIZE; j > 0; ++j)
+    // словарь следующего куска - хвост текущего, поэтому он копируется в начало следующего буфера
+    auto read_input = [&](const char *dictionary, size_t dict_len)
     {
-        byte |= (((data >> (j - 1)) & 1) << bit_shift);
-
-        if (++bit_shift == BYTE_SIZE)
-        {
-            out.put(byte);
-            byte = 0;
-            bit_shift = 0;
-        }
-    }
-}
-
-void append_string_data(ostream &out, const string &src, uint8_t &byte, uint8_t &bit_shift)
-{
-    for (uint8_t j = 0; j < src.size(); ++j)
+        string buffer = buffers.get();
+        buffer.resize(dict_len + chunk_size);
+        memcpy(&buffer[0], dictionary, dict_len);
+        size_t len = in.read(reinterpret_cast<uint8_t *>(&buffer[dict_len]), chunk_size);
+        buffer.resize(dict_len + len);
+        return ChunkInput{nullptr, move(buffer), dict_len, len, false};
+    };
+
+    // следующий кусок читаем заранее, чтобы знать, последний ли текущий
+    ChunkInput input = read_input(nullptr, 0);
+    while (true)
     {
-        uint8_t bit = (src[j] == '1') ? 1 : 0;
-        byte |= (bit << bit_shift);
+        size_t tail_len = min(input.dict_len + input.len, WINDOW_SIZE);
+        ChunkInput next = read_input(input.data() + input.dict_len + input.len - tail_len, tail_len);
+        input.is_last = (next.len == 0);
 
-        if (++bit_shift == BYTE_SIZE)
-        {
-            out.put(byte);
-            byte = 0;
-            bit_shift = 0;
-        }
+        if (!inputs.push(move(input)) || next.len == 0)
+            return;
+        input = move(next);
     }
 }
 
-void write_compressed_data(istream &in, ostream &out, uint32_t &crc, uint32_t &isize)
+// Сжатие конвейером из трёх стадий, связанных ограниченными очередями: поток чтения готовит куски входа,
+// сжатие идёт в текущем потоке (или, как у pigz, в пуле из threads постоянных рабочих потоков), а поток
+// записи по порядку выводит сжатые куски и возвращает их буферы в пул. Так ожидание диска при чтении и записи
+// перекрывается со сжатием. Каждый кусок сжимается со словарём из последних WINDOW_SIZE байт
+// предыдущего и выравнивается пустым хранимым блоком, так что куски склеиваются в один поток DEFLATE,
+// а CRC собирается через crc32_combine.
+void write_compressed_data(InputSource &in, ostream &out, uint32_t &crc, uint32_t &isize, const Options &options)
 {
-    size_t pos = 0;
-    size_t front = 0;
+    const LevelConfig &config = level_configs[options.level];
+    size_t chunk_size = (options.threads > 1) ? CHUNK_SIZE : STREAM_CHUNK_SIZE;
 
-    char buffer[BUF_SIZE];
-    uint8_t byte = 0;
-    uint8_t bit_shift = 0;
+    BufferPool buffers;
+    BoundedQueue<ChunkInput> inputs(options.threads + 1);
+    // вместе с куском, которого ждёт поток записи, сжимается не больше threads кусков
+    BoundedQueue<future<Chunk>> compressed(options.threads - 1);
+    BoundedQueue<CompressJob> jobs(options.threads);
 
-    uint32_t crc_table[256];
-    generate_crc32_table(crc_table);
-
-    in.read(buffer, MAX_MATCH_LEN);
-    front = in.gcount();
-
-    crc = 0xFFFFFFFF;
-    for (size_t i = 0; i < front; ++i)
-        crc = (crc >> 8) ^ crc_table[(crc ^ buffer[i]) & 0xFF];
-
-    vector<Match> block;
-    size_t curr_block_len = 0;
-
-    char symbol;
-    while (pos < front)
+    auto compress_chunk = [&config, &buffers](ChunkInput input)
     {
-        size_t window_start = (pos > WINDOW_SIZE) ? (pos - WINDOW_SIZE) : 0;
-
-        size_t best_match_len = 1;
-        size_t best_match_dist = 0;
-        for (size_t start = window_start; start < pos; ++start)
-        {
-            size_t match_len = 0;
-            while (match_len <= MAX_MATCH_LEN && (pos + match_len < front) &&
-                   buffer[(start + match_len) % BUF_SIZE] == buffer[(pos + match_len) % BUF_SIZE])
-                ++match_len;
-
-            if (match_len >= MIN_MATCH_LEN && match_len > best_match_len)
-            {
-                best_match_len = match_len;
-                best_match_dist = pos - start;
-            }
-        }
-
-        if (curr_block_len + best_match_dist > BLOCK_SIZE)
-        {
-            append_string_data(out, "010", byte, bit_shift);
-
-            for (const auto &[dist, len, ch] : block)
-            {
-                if (dist == 0)
-                {
-                    string code = get_literal_fixed_code(ch);
-                    append_string_data(out, code, byte, bit_shift);
-                }
-                else
-                {
-                    string len_code = get_length_fixed_code(len);
-                    string dist_code = get_distance_fixed_code(dist);
-
-                    append_string_data(out, len_code, byte, bit_shift);
-                    append_string_data(out, dist_code, byte, bit_shift);
-                }
-            }
-
-            append_string_data(out, END_OF_BLOCK, byte, bit_shift);
-
-            block.clear();
-            curr_block_len = 0;
-        }
-
-        if (best_match_dist == 0)
-        {
-            // печатаем сам символ
-            block.emplace_back(0, 1, buffer[pos % BUF_SIZE]);
-
-            ++pos;
-            ++curr_block_len;
-
-            if (in >> symbol)
-            {
-                buffer[front++ % BUF_SIZE] = symbol;
-                crc = (crc >> 8) ^ crc_table[(crc ^ symbol) & 0xFF];
-            }
-        }
-        else
-        {
-            // кодируем длину и расстояние
-            block.emplace_back(best_match_dist, best_match_len);
-
-            pos += best_match_len;
-            curr_block_len += best_match_len;
-
-            for (size_t i = 0; i < best_match_len; ++i)
-                if (in >> symbol)
-                {
-                    buffer[front++ % BUF_SIZE] = symbol;
-                    crc = (crc >> 8) ^ crc_table[(crc ^ symbol) & 0xFF];
-                }
-        }
+        Chunk chunk;
+        chunk.data = buffers.get();
+        deflate_stream(input.data(), input.dict_len, input.len, chunk.data, input.is_last, config, chunk.crc);
+        chunk.input = move(input.owned);
+        chunk.len = input.len;
+        return chunk;
+    };
+
+    crc = 0;
+    uint64_t total_len = 0;
+
+    future<void> reader = async(launch::async,
+                                [&]
+                                {
+                                    try
+                                    {
+                                        read_chunks(in, chunk_size, inputs, buffers);
+                                    }
+                                    catch (...)
+                                    {
+                                        inputs.close();
+                                        throw;
+                                    }
+                                    inputs.close();
+                                });
+
+    future<void> writer = async(launch::async,
+                                [&]
+                                {
+                                    try
+                                    {
+                                        future<Chunk> pending;
+                                        while (compressed.pop(pending))
+                                        {
+                                            Chunk chunk = pending.get();
+                                            out.write(chunk.data.data(), chunk.data.size());
+                                            crc = crc32_combine(crc, chunk.crc, chunk.len);
+                                            total_len += chunk.len;
+
+                                            buffers.put(move(chunk.data));
+                                            buffers.put(move(chunk.input));
+                                        }
+                                    }
+                                    catch (...)
+                                    {
+                                        compressed.close();
+                                        throw;
+                                    }
+                                });
+
+    // рабочие потоки живут до конца сжатия и берут куски из jobs; ошибку сжатия куска получит поток записи
+    vector<future<void>> workers;
+    if (options.threads > 1)
+    {
+        for (unsigned i = 0; i < options.threads; ++i)
+            workers.push_back(async(launch::async,
+                                    [&]
+                                    {
+                                        CompressJob job;
+                                        while (jobs.pop(job))
+                                        {
+                                            try
+                                            {
+                                                job.result.set_value(compress_chunk(move(job.input)));
+                                            }
+                                            catch (...)
+                                            {
+                                                job.result.set_exception(current_exception());
+                                            }
+                                        }
+                                    }));
     }
 
-    // Упаковываем последний блок
-    append_string_data(out, "110", byte, bit_shift);
-
-    for (const auto &[dist, len, ch] : block)
+    try
     {
-        if (dist == 0)
+        ChunkInput input;
+        while (inputs.pop(input))
         {
-            string code = get_literal_fixed_code(ch);
-            append_string_data(out, code, byte, bit_shift);
-        }
-        else
-        {
-            string len_code = get_length_fixed_code(len);
-            string dist_code = get_distance_fixed_code(dist);
-
-            append_string_data(out, len_code, byte, bit_shift);
-            append_string_data(out, dist_code, byte, bit_shift);
+            CompressJob job;
+            job.input = move(input);
+            if (options.threads == 1)
+                job.result.set_value(compress_chunk(move(job.input)));
+
+            // место в очереди записи занимается до того, как кусок попадёт к рабочим, так что в работе
+            // никогда не больше кусков, чем поток записи готов принять
+            if (!compressed.push(job.result.get_future()))
+                break;
+            if (options.threads > 1)
+                jobs.push(move(job));
         }
     }
+    catch (...)
+    {
+        // останавливаем остальные стадии, иначе они будут ждать нас вечно
+        inputs.close();
+        jobs.close();
+        compressed.close();
+        throw;
+    }
 
-    append_string_data(out, END_OF_BLOCK, byte, bit_shift);
-
-    if (bit_shift > 0)
-        out.put(byte);
+    // если поток записи упал, поток чтения может ждать места в очереди
+    compressed.close();
+    inputs.close();
+    jobs.close();
+    reader.get();
+    for (future<void> &worker : workers)
+        worker.get();
+    writer.get();
 
-    crc ^= 0xFFFFFFFF;
-    isize = pos;
+    isize = static_cast<uint32_t>(total_len);
 }
 
-void encode(istream &in, ostream &out, Options options)
+void encode(InputSource &in, ostream &out, Options options)
 {
-    out.put(0x1F);
-    out.put(0x8B);
-    out.put(0x08);
-
-    uint8_t flags;
+    ContainerHeader header;
     if (options.store_filename)
-        flags |= (1 << 3);
-
-    out.put(flags);
-
-    uint32_t mtime = get_current_unix_time();
-    for (int i = 0; i < 4; i++)
-        out.put((mtime >> 8 * i) & 0xFF);
+        header.file_name = options.file_name;
+    header.mtime = get_current_unix_time();
 
-    out.put(0x00);
-    out.put(0xFF);
-
-    if (options.store_filename)
-    {
-        for (auto ch : options.file_name)
-            out.put(ch);
-        out.put(0x00);
-    }
+    string wrapper;
+    write_container_header(wrapper, Container::GZIP, header);
+    out.write(wrapper.data(), wrapper.size());
 
     uint32_t crc;
     uint32_t isize;
 
-    write_compressed_data(in, out, crc, isize);
-
-    for (int i = 0; i < 4; i++)
-        out.put((crc >> 8 * i) & 0xFF);
+    write_compressed_data(in, out, crc, isize, options);
 
-    for (int i = 0; i < 4; i++)
-        out.put((isize >> 8 * i) & 0xFF);
+    wrapper.clear();
+    write_container_trailer(wrapper, Container::GZIP, crc, isize);
+    out.write(wrapper.data(), wrapper.size());
 }
 
 string cut_name(string filename)
@@ -351,34 +279,85 @@ string cut_name(string filename)
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    uint8_t level = DEFAULT_LEVEL;
+    unsigned threads = 1;
+    bool to_stdout = false;
+    string filename;
+
+    for (int i = 1; i < argc; ++i)
     {
-        cerr << "Передано не верное количество аргументов!" << endl;
-        return 1;
+        string arg = argv[i];
+        if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '0' + MIN_LEVEL && arg[1] <= '0' + MAX_LEVEL)
+            level = arg[1] - '0';
+        else if (arg == "-p" && i + 1 < argc)
+        {
+            int value = atoi(argv[++i]);
+            if (value <= 0)
+            {
+                cerr << "Число потоков должно быть положительным: " << argv[i] << endl;
+                return 1;
+            }
+            threads = value;
+        }
+        else if (arg == "-c")
+            to_stdout = true;
+        else if (filename.empty() && (arg[0] != '-' || arg == "-"))
+            filename = arg;
+        else
+        {
+            cerr << "Неизвестный аргумент: " << arg << endl;
+            return 1;
+        }
     }
 
-    string filename = argv[1];
+    // без файла (или с "-") сжимаем stdin в stdout, как gzip в конвейере
+    bool from_stdin = filename.empty() || filename == "-";
+    if (from_stdin)
+        to_stdout = true;
+
+    if (to_stdout && isatty(STDOUT_FILENO))
+    {
+        cerr << "Сжатые данные не выводятся на терминал, перенаправьте вывод!" << endl;
+        return 1;
+    }
 
-    ifstream input_file(filename);
-    if (!input_file.is_open())
+    unique_ptr<InputSource> input_file =
+        from_stdin ? make_unique<InputSource>(STDIN_FILENO) : make_unique<InputSource>(filename);
+    if (!input_file->is_open())
     {
         cerr << "Не удалось открыть файл для чтения!" << endl;
         return 1;
     }
 
-    ofstream output_file(filename + ".gz");
-    if (!output_file.is_open())
+    unique_ptr<OutputSink> output_file =
+        to_stdout ? make_unique<OutputSink>(STDOUT_FILENO) : make_unique<OutputSink>(filename + ".gz");
+    if (!output_file->is_open())
     {
         cerr << "Не удалось открыть файл для записи!" << endl;
         return 1;
     }
 
-    Options options = {true, cut_name(filename)};
+    Options options = {!from_stdin, from_stdin ? "" : cut_name(filename), level, threads};
 
-    encode(input_file, output_file, options);
+    try
+    {
+        // ошибка чтения или записи прерывает сжатие, а не теряется в состоянии потока
+        ostream output(output_file.get());
+        output.exceptions(ios::badbit);
+        encode(*input_file, output, options);
+        output.flush();
+    }
+    catch (const exception &e)
+    {
+        cerr << "Ошибка при сжатии: " << e.what() << endl;
 
-    input_file.close();
-    output_file.close();
+        // недописанный архив не оставляем, чтобы его не приняли за целый
+        output_file.reset();
+        if (!to_stdout)
+            unlink((filename + ".gz").c_str());
+        return 1;
+    }
 
-    cout << "Файл успешно обработан!" << endl;
-}
\ No newline at end of file
+    if (!to_stdout)
+        cout << "Файл успешно обработан!" << endl;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "bit_reader.h"
+#include "deflate_tables.h"
+
+// Табличный декодер канонического кода Хаффмана (как inflate_table в zlib и libdeflate).
+// Первичная таблица индексируется следующими primary_bits битами потока и сразу даёт символ
+// и длину его кода; коды длиннее primary_bits уходят во вторую таблицу по остатку битов.
+class HuffmanDecoder
+{
+   private:
+    struct Entry
+    {
+        uint16_t value;    // символ, либо смещение подтаблицы, если sub_bits != 0
+        uint8_t length;    // полная длина кода; 0 - такого кода нет
+        uint8_t sub_bits;  // ширина подтаблицы
+    };
+
+    std::vector<Entry> table;
+    std::vector<uint8_t> sub_bits;  // рабочий буфер build, хранится, чтобы не выделять его заново
+    uint8_t primary_bits = 0;
+
+   public:
+    HuffmanDecoder() = default;
+    HuffmanDecoder(const uint8_t *lengths, size_t count, uint8_t primary_bits) { build(lengths, count, primary_bits); }
+
+    // Строит таблицу по длинам кодов count <= FIXED_LIT_LEN_CODES символов; неполный код допускается,
+    // переполненный - нет. Память таблицы переиспользуется, так что повторная сборка ничего не выделяет.
+    void build(const uint8_t *lengths, size_t count, uint8_t primary_bits)
+    {
+        if (count > FIXED_LIT_LEN_CODES)
+            throw std::runtime_error("too many Huffman symbols");
+
+        this->primary_bits = primary_bits;
+
+        uint16_t bl_count[MAX_CODE_BITS + 1] = {};
+        for (size_t i = 0; i < count; ++i)
+            ++bl_count[lengths[i]];
+        bl_count[0] = 0;
+
+        int32_t left = 1;
+        for (uint8_t bits = 1; bits <= MAX_CODE_BITS; ++bits)
+        {
+            left = (left << 1) - bl_count[bits];
+            if (left < 0)
+                throw std::runtime_error("over-subscribed Huffman code");
+        }
+
+        uint16_t next_code[MAX_CODE_BITS + 1] = {};
+        uint16_t code = 0;
+        for (uint8_t bits = 1; bits <= MAX_CODE_BITS; ++bits)
+        {
+            code = (code + bl_count[bits - 1]) << 1;
+            next_code[bits] = code;
+        }
+
+        // коды читаются из потока старшим битом вперёд, а индексы таблицы собираются младшими битами,
+        // поэтому индексом служит развёрнутый код
+        uint16_t reversed[FIXED_LIT_LEN_CODES] = {};
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (lengths[i] == 0)
+                continue;
+
+            uint16_t c = next_code[lengths[i]]++;
+            for (uint8_t bit = 0; bit < lengths[i]; ++bit)
+                reversed[i] |= ((c >> bit) & 1) << (lengths[i] - 1 - bit);
+        }
+
+        const uint32_t primary_size = 1u << primary_bits;
+        const uint32_t primary_mask = primary_size - 1;
+        table.assign(primary_size, Entry{0, 0, 0});
+
+        // под каждый первичный префикс длинных кодов - подтаблица на самый длинный из них
+        sub_bits.assign(primary_size, 0);
+        for (size_t i = 0; i < count; ++i)
+            if (lengths[i] > primary_bits)
+            {
+                uint8_t &bits = sub_bits[reversed[i] & primary_mask];
+                bits = std::max<uint8_t>(bits, lengths[i] - primary_bits);
+            }
+
+        for (uint32_t prefix = 0; prefix < primary_size; ++prefix)
+            if (sub_bits[prefix] != 0)
+            {
+                table[prefix] = {static_cast<uint16_t>(table.size()), 0, sub_bits[prefix]};
+                table.resize(table.size() + (size_t(1) << sub_bits[prefix]), Entry{0, 0, 0});
+            }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint8_t len = lengths[i];
+            if (len == 0)
+                continue;
+
+            Entry entry = {static_cast<uint16_t>(i), len, 0};
+            if (len <= primary_bits)
+            {
+                for (uint32_t index = reversed[i]; index < primary_size; index += 1u << len)
+                    table[index] = entry;
+            }
+            else
+            {
+                const Entry &sub = table[reversed[i] & primary_mask];
+                for (uint32_t index = reversed[i] >> primary_bits; index < (1u << sub.sub_bits);
+                     index += 1u << (len - primary_bits))
+                    table[sub.value + index] = entry;
+            }
+        }
+    }
+
+    // Декодирует один символ; в аккумуляторе reader должно быть не меньше MAX_CODE_BITS бит
+    uint16_t decode(BitReader &reader) const
+    {
+        uint32_t bits = reader.peek(MAX_CODE_BITS);
+
+        const Entry *entry = &table[bits & ((1u << primary_bits) - 1)];
+        if (entry->sub_bits != 0)
+            entry = &table[entry->value + ((bits >> primary_bits) & ((1u << entry->sub_bits) - 1))];
+
+        if (entry->length == 0)
+            throw std::runtime_error("invalid Huffman code");
+
+        reader.consume(entry->length);
+        return entry->value;
+    }
+};
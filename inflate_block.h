@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#include "bit_reader.h"
+#include "deflate_tables.h"
+#include "huffman_decoder.h"
+
+// Распаковка блоков DEFLATE прямо из битового потока (RFC 1951, 3.2.3-3.2.7).
+// Общий код для gzip_decoder.cpp и deflate_unpack.cpp. Байты уходят в окно вывода Window
+// с методами put(ch), put_match(dist, len) и copy_stored(reader, len).
+
+constexpr uint8_t LIT_LEN_PRIMARY_BITS = 9;
+constexpr uint8_t DIST_PRIMARY_BITS = 6;
+
+// Декодеры статических кодов (BTYPE=01): длины фиксированы RFC 1951, 3.2.6
+inline const HuffmanDecoder &get_fixed_lit_decoder()
+{
+    static const HuffmanDecoder decoder = []
+    {
+        uint8_t lengths[FIXED_LIT_LEN_CODES];
+        for (uint16_t i = 0; i < FIXED_LIT_LEN_CODES; ++i)
+            lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+        return HuffmanDecoder(lengths, FIXED_LIT_LEN_CODES, LIT_LEN_PRIMARY_BITS);
+    }();
+    return decoder;
+}
+
+inline const HuffmanDecoder &get_fixed_dist_decoder()
+{
+    static const HuffmanDecoder decoder = []
+    {
+        uint8_t lengths[DIST_CODES];
+        std::fill(lengths, lengths + DIST_CODES, 5);
+        return HuffmanDecoder(lengths, DIST_CODES, DIST_PRIMARY_BITS);
+    }();
+    return decoder;
+}
+
+// Хранимый блок (BTYPE=00): после выравнивания LEN, его дополнение NLEN и LEN байт как есть
+template <typename Window>
+void inflate_stored_block(BitReader &reader, Window &window)
+{
+    uint8_t header[4];
+    reader.align_to_byte();
+    reader.read_bytes(header, 4);
+
+    uint16_t len = header[0] | (header[1] << 8);
+    uint16_t nlen = header[2] | (header[3] << 8);
+    if (len != static_cast<uint16_t>(~nlen))
+        throw std::runtime_error("invalid stored block lengths");
+
+    window.copy_stored(reader, len);
+}
+
+// Заголовок динамического блока (BTYPE=10): длины кодов литералов/длин и расстояний,
+// сжатые кодом длин кодов с повторами 16/17/18 (RFC 1951, 3.2.7). Все три декодера
+// перестраиваются на месте, code_len_decoder нужен только как рабочий
+inline void read_dynamic_decoders(BitReader &reader, HuffmanDecoder &lit_decoder, HuffmanDecoder &dist_decoder,
+                                  HuffmanDecoder &code_len_decoder)
+{
+    uint16_t hlit = reader.read_bits(5) + FIRST_LENGTH_CODE;
+    uint8_t hdist = reader.read_bits(5) + 1;
+    uint8_t hclen = reader.read_bits(4) + 4;
+
+    if (hlit > LIT_LEN_CODES || hdist > DIST_CODES)
+        throw std::runtime_error("too many length or distance symbols");
+
+    uint8_t code_len_lengths[CODE_LEN_CODES] = {};
+    for (uint8_t i = 0; i < hclen; ++i)
+        code_len_lengths[code_len_order[i]] = reader.read_bits(3);
+
+    code_len_decoder.build(code_len_lengths, CODE_LEN_CODES, MAX_CODE_LEN_BITS);
+
+    // длины обоих алфавитов идут одной последовательностью, и повтор может переходить из одного в другой
+    uint8_t lengths[LIT_LEN_CODES + DIST_CODES] = {};
+    uint16_t count = 0;
+    while (count < hlit + hdist)
+    {
+        reader.refill();
+
+        uint16_t symbol = code_len_decoder.decode(reader);
+        if (symbol < 16)
+        {
+            lengths[count++] = symbol;
+            continue;
+        }
+
+        uint8_t value = 0;
+        uint8_t repeat;
+        if (symbol == 16)
+        {
+            if (count == 0)
+                throw std::runtime_error("repeat of missing code length");
+            value = lengths[count - 1];
+            repeat = 3 + reader.read_bits(2);
+        }
+        else if (symbol == 17)
+            repeat = 3 + reader.read_bits(3);
+        else
+            repeat = 11 + reader.read_bits(7);
+
+        if (count + repeat > hlit + hdist)
+            throw std::runtime_error("too many code lengths");
+
+        std::fill(lengths + count, lengths + count + repeat, value);
+        count += repeat;
+    }
+
+    if (reader.is_overrun())
+        throw std::runtime_error("unexpected end of deflate stream");
+    if (lengths[END_OF_BLOCK_CODE] == 0)
+        throw std::runtime_error("missing end-of-block code");
+
+    lit_decoder.build(lengths, hlit, LIT_LEN_PRIMARY_BITS);
+    dist_decoder.build(lengths + hlit, hdist, DIST_PRIMARY_BITS);
+}
+
+// Символы блока со статическими или динамическими кодами вплоть до конца блока
+template <typename Window>
+void inflate_huffman_block(BitReader &reader, Window &window, const HuffmanDecoder &lit_decoder,
+                           const HuffmanDecoder &dist_decoder)
+{
+    while (true)
+    {
+        // одного пополнения хватает на весь символ: код длины, её доп. биты, код расстояния и его доп. биты
+        reader.refill();
+
+        uint16_t symbol = lit_decoder.decode(reader);
+        if (symbol < END_OF_BLOCK_CODE)
+        {
+            window.put(static_cast<char>(symbol));
+            continue;
+        }
+
+        if (symbol == END_OF_BLOCK_CODE)
+            break;
+
+        uint16_t len_code = symbol - FIRST_LENGTH_CODE;
+        if (len_code >= LENGTH_CODES)
+            throw std::runtime_error("invalid length symbol");
+
+        size_t len = length_base[len_code] + reader.peek(length_extra_bits[len_code]);
+        reader.consume(length_extra_bits[len_code]);
+
+        uint16_t dist_code = dist_decoder.decode(reader);
+        if (dist_code >= DIST_CODES)
+            throw std::runtime_error("invalid distance symbol");
+
+        size_t dist = dist_base[dist_code] + reader.peek(dist_extra_bits[dist_code]);
+        reader.consume(dist_extra_bits[dist_code]);
+
+        window.put_match(dist, len);
+    }
+
+    if (reader.is_overrun())
+        throw std::runtime_error("unexpected end of deflate stream");
+}
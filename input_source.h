@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Источник входных данных без iostream. Обычный файл отображается в память целиком (mmap с
+// madvise(MADV_SEQUENTIAL)), и его байты доступны как один непрерывный диапазон data()/size().
+// Канал, устройство или файл, который не удалось отобразить, читается через read кусками.
+class InputSource
+{
+   private:
+    int fd;
+    bool owns_fd;
+    const uint8_t *mapped;  // nullptr, если файл не отображён
+    size_t mapped_size;
+    uint64_t offset;  // позиция чтения для read/seek у отображённого файла
+
+    void map()
+    {
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return;
+
+        mapped_size = st.st_size;
+        if (mapped_size == 0)
+        {
+            // пустой файл не отображается, но и читать из него нечего
+            static const uint8_t empty = 0;
+            mapped = &empty;
+            return;
+        }
+
+        void *addr = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            mapped_size = 0;
+            return;
+        }
+
+        madvise(addr, mapped_size, MADV_SEQUENTIAL);
+        mapped = static_cast<const uint8_t *>(addr);
+    }
+
+   public:
+    explicit InputSource(const std::string &path)
+        : fd(open(path.c_str(), O_RDONLY)), owns_fd(true), mapped(nullptr), mapped_size(0), offset(0)
+    {
+        map();
+    }
+
+    // Уже открытый дескриптор, например 0 для stdin; закрывать его будет вызывающий
+    explicit InputSource(int fd) : fd(fd), owns_fd(false), mapped(nullptr), mapped_size(0), offset(0) { map(); }
+
+    InputSource(const InputSource &) = delete;
+    InputSource &operator=(const InputSource &) = delete;
+
+    ~InputSource()
+    {
+        if (mapped != nullptr && mapped_size != 0)
+            munmap(const_cast<uint8_t *>(mapped), mapped_size);
+        if (owns_fd && fd >= 0)
+            close(fd);
+    }
+
+    bool is_open() const { return fd >= 0; }
+    bool is_mapped() const { return mapped != nullptr; }
+
+    // Всё содержимое отображённого файла; только если is_mapped()
+    const uint8_t *data() const { return mapped; }
+    size_t size() const { return mapped_size; }
+
+    // Размер обычного файла, 0 для канала
+    uint64_t file_size() const
+    {
+        struct stat st;
+        return (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? st.st_size : 0;
+    }
+
+    // Текущая позиция чтения
+    uint64_t tell() const { return is_mapped() ? offset : lseek(fd, 0, SEEK_CUR); }
+
+    void seek(uint64_t pos)
+    {
+        if (is_mapped())
+            offset = std::min<uint64_t>(pos, mapped_size);
+        else if (lseek(fd, pos, SEEK_SET) < 0)
+            throw std::runtime_error("input is not seekable");
+    }
+
+    // Подгружает страницы [offset, offset + len) отображённого файла, чтобы ждать диска пришлось
+    // вызывающему потоку, а не тому, кто потом будет их читать; для неотображённого ничего не делает
+    void prefetch(uint64_t offset, size_t len) const
+    {
+        if (!is_mapped() || len == 0 || offset >= mapped_size)
+            return;
+
+        len = std::min<uint64_t>(len, mapped_size - offset);
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        uint64_t begin = offset / page_size * page_size;
+        madvise(const_cast<uint8_t *>(mapped) + begin, offset + len - begin, MADV_WILLNEED);
+
+        // madvise только просит прочитать заранее, а обращение к каждой странице дожидается её
+        volatile uint8_t sink = 0;
+        for (uint64_t pos = begin; pos < offset + len; pos += page_size)
+            sink = sink ^ mapped[pos];
+    }
+
+    // Читает до len байт; возвращает меньше только в конце данных, 0 - данные кончились
+    size_t read(uint8_t *out, size_t len)
+    {
+        if (is_mapped())
+        {
+            size_t count = std::min<uint64_t>(len, mapped_size - offset);
+            memcpy(out, mapped + offset, count);
+            offset += count;
+            return count;
+        }
+
+        size_t done = 0;
+        while (done < len)
+        {
+            ssize_t count = ::read(fd, out + done, len - done);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count < 0)
+                throw std::runtime_error(std::string("read error: ") + strerror(errno));
+            if (count == 0)
+                break;
+            done += count;
+        }
+        return done;
+    }
+};
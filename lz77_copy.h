@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Копирование совпадения LZ77 при распаковке. Вместо побайтного цикла с делением по модулю
+// байты переносятся словами по 8 и 16 байт, а короткий повторяющийся шаблон сначала
+// размножается до целого слова. Слова могут выйти за конец совпадения, поэтому после него
+// в буфере нужен запас в MATCH_COPY_PADDING байт; что туда попало, перезапишут следующие символы.
+
+constexpr size_t MATCH_COPY_PADDING = 32;
+
+inline uint64_t load_word(const char *src)
+{
+    uint64_t word;
+    memcpy(&word, src, sizeof(word));
+    return word;
+}
+
+inline void store_word(char *dst, uint64_t word) { memcpy(dst, &word, sizeof(word)); }
+
+// Дописывает в dst len байт, начинающихся на dist байт раньше; dist >= 1 и все они уже в буфере
+inline void copy_match(char *dst, size_t dist, size_t len)
+{
+    const char *src = dst - dist;
+    char *end = dst + len;
+
+    if (dist >= 16)
+    {
+        // источник и приёмник каждой 16-байтовой порции не пересекаются
+        do
+        {
+            memcpy(dst, src, 16);
+            dst += 16;
+            src += 16;
+        } while (dst < end);
+        return;
+    }
+
+    if (dist >= 8)
+    {
+        do
+        {
+            store_word(dst, load_word(src));
+            dst += 8;
+            src += 8;
+        } while (dst < end);
+        return;
+    }
+
+    if (dist == 1 || dist == 2 || dist == 4)
+    {
+        // период делит 8, так что слово из повторённого шаблона годится для любой позиции
+        uint64_t pattern = 0;
+        for (uint8_t i = 0; i < 8; ++i)
+            pattern |= uint64_t(static_cast<uint8_t>(src[i % dist])) << (8 * i);
+
+        do
+        {
+            store_word(dst, pattern);
+            dst += 8;
+        } while (dst < end);
+        return;
+    }
+
+    // dist 3, 5, 6, 7: побайтно набираем первые период*k >= 8 байт, дальше копируем словами с этого расстояния
+    size_t wide_dist = dist * ((8 + dist - 1) / dist);
+    for (size_t i = 0; i < wide_dist; ++i)
+        dst[i] = src[i];
+    dst += wide_dist;
+
+    while (dst < end)
+    {
+        store_word(dst, load_word(dst - wide_dist));
+        dst += 8;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "lz77_copy.h"
+
+// Длина общего начала двух строк при поиске совпадений LZ77. Байты сравниваются не по одному,
+// а сразу по 32 (AVX2) или 16 (SSE2): маска равных байт из movemask, первый отличающийся - её ctz.
+// Без SIMD и на хвосте то же делают 64-битные слова: XOR и ctz первого ненулевого бита.
+// Читается не дальше max_len байт от каждого начала, так что запас за концом данных не нужен.
+
+// Номер первого различающегося байта в ненулевом XOR двух слов, загруженных через load_word
+inline size_t first_diff_byte(uint64_t diff)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_clzll(diff) >> 3;
+#else
+    return __builtin_ctzll(diff) >> 3;
+#endif
+}
+
+// Сколько первых байт a и b совпадают, но не больше max_len; сравнение начинается с байта len,
+// когда первые len байт уже известны как равные
+inline size_t match_length(const char *a, const char *b, size_t max_len, size_t len = 0)
+{
+#if defined(__AVX2__)
+    while (len + 32 <= max_len)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + len));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + len));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+        if (mask != 0)
+            return len + __builtin_ctz(mask);
+        len += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    while (len + 16 <= max_len)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + len));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + len));
+        uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFF;
+        if (mask != 0)
+            return len + __builtin_ctz(mask);
+        len += 16;
+    }
+#endif
+
+    while (len + 8 <= max_len)
+    {
+        uint64_t diff = load_word(a + len) ^ load_word(b + len);
+        if (diff != 0)
+            return len + first_diff_byte(diff);
+        len += 8;
+    }
+
+    while (len < max_len && a[len] == b[len])
+        ++len;
+    return len;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Вывод в файловый дескриптор без ofstream: байты копятся в большом выровненном по странице буфере
+// и уходят одним write, а кусок крупнее буфера пишется через writev вместе с накопленным, без копирования.
+// vmsplice здесь не годится: страницы, которые следующий процесс переносит из канала дальше через splice,
+// остаются ссылками на наш буфер и после того, как покинули канал, так что писать в него снова нельзя.
+class OutputSink : public std::streambuf
+{
+   private:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    int fd;
+    bool owns_fd;
+    char *buffer;
+
+    void init()
+    {
+        size_t alignment = std::max<long>(sysconf(_SC_PAGESIZE), 64);
+        buffer = static_cast<char *>(aligned_alloc(alignment, BUFFER_SIZE));
+        if (buffer == nullptr)
+            throw std::bad_alloc();
+
+        setp(buffer, buffer + BUFFER_SIZE);
+    }
+
+    [[noreturn]] static void throw_error() { throw std::runtime_error(std::string("write error: ") + strerror(errno)); }
+
+    void write_all(struct iovec *iov, int count)
+    {
+        while (count > 0)
+        {
+            ssize_t written = writev(fd, iov, count);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0)
+                throw_error();
+
+            // пропускаем целиком записанные куски и сдвигаем начало недописанного
+            while (count > 0 && static_cast<size_t>(written) >= iov->iov_len)
+            {
+                written -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0)
+            {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+                iov->iov_len -= written;
+            }
+        }
+    }
+
+    void write_all(const char *data, size_t len)
+    {
+        struct iovec iov = {const_cast<char *>(data), len};
+        write_all(&iov, 1);
+    }
+
+    void flush_buffer()
+    {
+        size_t len = pptr() - pbase();
+        if (len == 0)
+            return;
+
+        write_all(pbase(), len);
+        setp(buffer, buffer + BUFFER_SIZE);
+    }
+
+   protected:
+    int_type overflow(int_type ch) override
+    {
+        flush_buffer();
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize count) override
+    {
+        size_t len = count;
+
+        // крупный кусок отправляем вместе с накопленным без копирования в буфер
+        if (len >= BUFFER_SIZE)
+        {
+            struct iovec iov[2] = {{pbase(), static_cast<size_t>(pptr() - pbase())}, {const_cast<char *>(data), len}};
+            write_all(iov, 2);
+            setp(buffer, buffer + BUFFER_SIZE);
+            return count;
+        }
+
+        while (len > 0)
+        {
+            size_t part = std::min<size_t>(len, epptr() - pptr());
+            memcpy(pptr(), data, part);
+            pbump(static_cast<int>(part));
+            data += part;
+            len -= part;
+
+            if (pptr() == epptr())
+                flush_buffer();
+        }
+        return count;
+    }
+
+    int sync() override
+    {
+        flush_buffer();
+        return 0;
+    }
+
+   public:
+    explicit OutputSink(const std::string &path)
+        : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)), owns_fd(true), buffer(nullptr)
+    {
+        init();
+    }
+
+    // Уже открытый дескриптор, например 1 для stdout; закрывать его будет вызывающий
+    explicit OutputSink(int fd) : fd(fd), owns_fd(false), buffer(nullptr) { init(); }
+
+    OutputSink(const OutputSink &) = delete;
+    OutputSink &operator=(const OutputSink &) = delete;
+
+    ~OutputSink() override
+    {
+        try
+        {
+            if (fd >= 0)
+                flush_buffer();
+        }
+        catch (const std::exception &)
+        {
+        }
+
+        free(buffer);
+        if (owns_fd && fd >= 0)
+            close(fd);
+    }
+
+    bool is_open() const { return fd >= 0; }
+};
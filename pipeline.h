@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Очередь между стадиями конвейера: push ждёт, пока в очереди меньше capacity элементов, pop - пока
+// в ней что-нибудь появится. После close новые элементы не принимаются, а pop отдаёт оставшиеся и затем false.
+template <typename T>
+class BoundedQueue
+{
+   private:
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+
+   public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(capacity, 1)), closed(false) {}
+
+    // false, если очередь закрыта и элемент не принят
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed)
+            return false;
+
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // false, если очередь закрыта и пуста
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+
+// Освободившиеся буферы, которые стадии конвейера берут снова, чтобы не выделять память на каждый кусок
+class BufferPool
+{
+   private:
+    std::mutex mutex;
+    std::vector<std::string> buffers;
+
+   public:
+    // Пустая строка, по возможности с уже выделенной памятью
+    std::string get()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (buffers.empty())
+            return std::string();
+
+        std::string buffer = std::move(buffers.back());
+        buffers.pop_back();
+        return buffer;
+    }
+
+    void put(std::string buffer)
+    {
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.push_back(std::move(buffer));
+    }
+};
@@ -0,0 +1,253 @@
+#!/bin/bash
+# Регрессионные проверки gzip_encoder/gzip_decoder и deflate_pack/deflate_unpack.
+# Запуск из корня репозитория: tests/run_tests.sh
+
+set -u
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CXX=${CXX:-g++}
+CXXFLAGS="-std=c++17 -O2 -Wall -pthread"
+FAILED=0
+
+for tool in gzip_encoder gzip_decoder deflate_pack deflate_unpack; do
+    $CXX $CXXFLAGS "$ROOT/$tool.cpp" -o "$WORK/$tool" || exit 1
+done
+
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+pass() {
+    echo "ok: $1"
+}
+
+# Как timeout из GNU coreutils, которого нет на macOS: код команды или 124, если она не уложилась
+# в seconds секунд и была остановлена
+run_with_timeout() {
+    local seconds=$1
+    shift
+    "$@" &
+    local pid=$!
+    (sleep "$seconds"; kill "$pid") > /dev/null 2>&1 &
+    local watchdog=$!
+    wait "$pid"
+    local status=$?
+    if ! kill "$watchdog" 2> /dev/null; then
+        return 124
+    fi
+    return $status
+}
+
+# Распаковщик должен отказаться от обрезанного потока обычной ошибкой: код 1 и сообщение о конце данных,
+# а не зависнуть, упасть с сигналом или принять поток
+expect_truncated_error() {
+    local name=$1
+    shift
+    run_with_timeout 10 "$@" > /dev/null 2> "$WORK/truncated.err"
+    local status=$?
+    if [ $status -eq 0 ]; then
+        fail "$name accepted a truncated stream"
+    elif [ $status -eq 124 ]; then
+        fail "$name did not stop on a truncated stream"
+    elif [ $status -ne 1 ] || ! grep -q "unexpected end of deflate stream" "$WORK/truncated.err"; then
+        fail "$name exited with $status on a truncated stream: $(cat "$WORK/truncated.err")"
+    else
+        pass "$name rejects a truncated stream"
+    fi
+}
+
+# текст, который сжимается динамическими блоками
+seq 1 20000 > "$WORK/numbers.txt"
+
+# Обрезанный поток: нули за концом данных не должны бесконечно декодироваться в литералы
+"$WORK/gzip_encoder" -c "$WORK/numbers.txt" | head -c 1000 > "$WORK/cut.gz"
+expect_truncated_error gzip_decoder "$WORK/gzip_decoder" -dc "$WORK/cut.gz"
+
+cp "$WORK/numbers.txt" "$WORK/cut.txt"
+"$WORK/deflate_pack" "$WORK/cut.txt" > /dev/null
+head -c 1000 "$WORK/cut.txt.pk" > "$WORK/cut.pk"
+mv "$WORK/cut.pk" "$WORK/cut.txt.pk"
+expect_truncated_error deflate_unpack "$WORK/deflate_unpack" "$WORK/cut.txt.pk"
+
+# Ошибка чтения - обычная ошибка с кодом 1, а недописанный архив удаляется
+mkdir "$WORK/dir"
+"$WORK/gzip_encoder" "$WORK/dir" > /dev/null 2> "$WORK/dir.err"
+status=$?
+if [ $status -ne 1 ] || ! grep -q "read error" "$WORK/dir.err"; then
+    fail "gzip_encoder exits with $status on an unreadable input"
+elif [ -e "$WORK/dir.gz" ]; then
+    fail "gzip_encoder left a partial archive behind"
+else
+    pass "gzip_encoder reports a read error and removes the partial archive"
+fi
+
+# --ultra не должен давать файл больше, чем обычный режим
+head -c 1000000 /dev/zero > "$WORK/zeros.txt"
+head -c 100000 /dev/urandom > "$WORK/random.bin"
+cp "$ROOT"/tests/test*.txt "$WORK/"
+for input in "$WORK/numbers.txt" "$WORK/zeros.txt" "$WORK/random.bin" "$WORK"/test*.txt; do
+    "$WORK/deflate_pack" "$input" > /dev/null
+    default_size=$(wc -c < "$input.pk")
+    "$WORK/deflate_pack" --ultra "$input" > /dev/null
+    ultra_size=$(wc -c < "$input.pk")
+    if [ "$ultra_size" -gt "$default_size" ]; then
+        fail "--ultra is larger than the default on $(basename "$input"): $ultra_size > $default_size"
+    else
+        pass "--ultra is not larger than the default on $(basename "$input")"
+    fi
+done
+
+# Круговые проверки: то, что сжали мы, распаковывают gzip и zlib из Python, и наоборот
+same() {
+    if cmp -s "$2" "$3"; then
+        pass "$1"
+    else
+        fail "$1"
+    fi
+}
+
+# текст вперемешку с несжимаемыми кусками и повторами, больше одного куска -p, одного члена BGZF
+# и одного шага индекса
+seq 100000 200000 > "$WORK/more.txt"
+cat "$WORK/numbers.txt" "$WORK/random.bin" "$WORK"/test*.txt "$WORK/zeros.txt" "$WORK/more.txt" > "$WORK/mixed.bin"
+
+for level in 1 2 3 4 5 6 7 8 9; do
+    cp "$WORK/mixed.bin" "$WORK/level.bin"
+    "$WORK/gzip_encoder" -$level "$WORK/level.bin" > /dev/null
+    gzip -dc "$WORK/level.bin.gz" > "$WORK/level.out"
+    same "gzip -dc reads gzip_encoder -$level" "$WORK/level.out" "$WORK/mixed.bin"
+    "$WORK/gzip_decoder" -dc "$WORK/level.bin.gz" > "$WORK/level.out"
+    same "gzip_decoder reads gzip_encoder -$level" "$WORK/level.out" "$WORK/mixed.bin"
+done
+
+for threads in 1 3; do
+    "$WORK/gzip_encoder" -p $threads < "$WORK/mixed.bin" > "$WORK/threads.gz"
+    gzip -dc < "$WORK/threads.gz" > "$WORK/threads.out"
+    same "gzip -dc reads gzip_encoder -p $threads from stdin to stdout" "$WORK/threads.out" "$WORK/mixed.bin"
+    "$WORK/gzip_decoder" -p $threads < "$WORK/threads.gz" > "$WORK/threads.out"
+    same "gzip_decoder -p $threads reads stdin to stdout" "$WORK/threads.out" "$WORK/mixed.bin"
+done
+
+# несколько членов подряд и файл с именем внутри, как их пишет gzip
+gzip -c "$WORK/numbers.txt" > "$WORK/members.gz"
+gzip -c "$WORK/random.bin" >> "$WORK/members.gz"
+cat "$WORK/numbers.txt" "$WORK/random.bin" > "$WORK/members.bin"
+"$WORK/gzip_decoder" -dc "$WORK/members.gz" > "$WORK/members.out"
+same "gzip_decoder reads concatenated gzip members" "$WORK/members.out" "$WORK/members.bin"
+
+cp "$WORK/mixed.bin" "$WORK/named.bin"
+gzip -f "$WORK/named.bin"
+"$WORK/gzip_decoder" "$WORK/named.bin.gz" > /dev/null
+same "gzip_decoder restores the file name stored by gzip" "$WORK/named.bin" "$WORK/mixed.bin"
+
+# произвольный доступ по индексу
+gzip -c "$WORK/mixed.bin" > "$WORK/index.gz"
+"$WORK/gzip_decoder" --index --span 1 "$WORK/index.gz" > /dev/null
+for range in 0:1000 500000:70000 1234567:200000; do
+    offset=${range%:*}
+    len=${range#*:}
+    "$WORK/gzip_decoder" --range $range "$WORK/index.gz" > "$WORK/range.out"
+    tail -c +$((offset + 1)) "$WORK/mixed.bin" | head -c $len > "$WORK/range.bin"
+    same "gzip_decoder --range $range with an index" "$WORK/range.out" "$WORK/range.bin"
+done
+
+if command -v python3 > /dev/null; then
+    # BGZF: члены по 64 КиБ с размером в подполе BC и пустой член в конце, как у bgzip
+    python3 - "$WORK/mixed.bin" "$WORK/mixed.bgz" << 'END'
+import struct, sys, zlib
+data = open(sys.argv[1], 'rb').read()
+with open(sys.argv[2], 'wb') as out:
+    for i in range(0, len(data), 65280):
+        block = data[i:i + 65280]
+        deflate = zlib.compressobj(6, zlib.DEFLATED, -15)
+        body = deflate.compress(block) + deflate.flush()
+        out.write(struct.pack('<4BI2BH2BHH', 0x1F, 0x8B, 8, 4, 0, 0, 0xFF, 6, 66, 67, 2, len(body) + 25))
+        out.write(body + struct.pack('<II', zlib.crc32(block), len(block)))
+    out.write(bytes.fromhex('1f8b08040000000000ff0600424302001b0003000000000000000000'))
+END
+    for threads in 1 4; do
+        "$WORK/gzip_decoder" -p $threads -dc "$WORK/mixed.bgz" > "$WORK/bgzf.out"
+        same "gzip_decoder -p $threads reads BGZF" "$WORK/bgzf.out" "$WORK/mixed.bin"
+    done
+
+    # словарь - текст, похожий на сжимаемый, но не входящий в него
+    tail -c 320000 "$WORK/mixed.bin" | head -c 20000 > "$WORK/dict.bin"
+    tail -c 300000 "$WORK/mixed.bin" > "$WORK/plain.bin"
+
+    # deflate_pack -> zlib из Python; после сырого потока deflate_pack пишет перевод строки
+    for options in "" "--ultra" "--zlib" "--zlib --ultra" "--zlib --dict $WORK/dict.bin" \
+        "--zlib --ultra --dict $WORK/dict.bin" "--gzip"; do
+        "$WORK/deflate_pack" $options "$WORK/plain.bin" > /dev/null
+        python3 - "$WORK/plain.bin.pk" "$WORK/dict.bin" "$options" > "$WORK/pack.out" << 'END'
+import sys, zlib
+data = open(sys.argv[1], 'rb').read()
+options = sys.argv[3].split()
+wbits = 15 if '--zlib' in options else 31 if '--gzip' in options else -15
+zdict = open(sys.argv[2], 'rb').read() if '--dict' in options else b''
+sys.stdout.buffer.write(zlib.decompressobj(wbits, zdict=zdict).decompress(data))
+END
+        same "zlib reads deflate_pack ${options//$WORK\//}" "$WORK/pack.out" "$WORK/plain.bin"
+    done
+    "$WORK/deflate_pack" --gzip "$WORK/plain.bin" > /dev/null
+    gzip -dc < "$WORK/plain.bin.pk" > "$WORK/pack.out"
+    same "gzip -dc reads deflate_pack --gzip" "$WORK/pack.out" "$WORK/plain.bin"
+
+    # zlib из Python -> deflate_unpack; к распакованному deflate_unpack дописывает перевод строки
+    for options in "--zlib" "--zlib --dict $WORK/dict.bin" "--gzip"; do
+        python3 - "$WORK/plain.bin" "$WORK/dict.bin" "$options" > "$WORK/unpack.bin.pk" << 'END'
+import sys, zlib
+data = open(sys.argv[1], 'rb').read()
+options = sys.argv[3].split()
+wbits = 15 if '--zlib' in options else 31
+zdict = open(sys.argv[2], 'rb').read() if '--dict' in options else b''
+deflate = zlib.compressobj(9, zlib.DEFLATED, wbits, zdict=zdict) if zdict else zlib.compressobj(9, zlib.DEFLATED, wbits)
+sys.stdout.buffer.write(deflate.compress(data) + deflate.flush())
+END
+        "$WORK/deflate_unpack" $options "$WORK/unpack.bin.pk" > /dev/null
+        cp "$WORK/plain.bin" "$WORK/unpack.expected"
+        echo >> "$WORK/unpack.expected"
+        same "deflate_unpack ${options//$WORK\//} reads zlib output" "$WORK/unpack.bin" "$WORK/unpack.expected"
+    done
+else
+    echo "skip: python3 not found, BGZF and zlib round trips not run"
+fi
+
+# Вывод в канал: следующий процесс переносит страницы дальше через splice и читает их с задержкой,
+# так что байты, уже ушедшие из нашего канала, не должны меняться при следующих записях
+if [ "$(uname)" = Linux ]; then
+    cat > "$WORK/splicer.cpp" << 'END'
+#include <fcntl.h>
+#include <unistd.h>
+
+int main()
+{
+    ssize_t n;
+    while ((n = splice(0, nullptr, 1, nullptr, 1 << 20, SPLICE_F_MOVE)) > 0)
+        ;
+    return n < 0;
+}
+END
+    $CXX -O2 "$WORK/splicer.cpp" -o "$WORK/splicer" || exit 1
+    head -c 20000000 /dev/urandom > "$WORK/pipe.bin"
+
+    "$WORK/gzip_encoder" -1 -c < "$WORK/pipe.bin" | "$WORK/splicer" | (sleep 3; cat) > "$WORK/pipe.gz"
+    if gzip -dc "$WORK/pipe.gz" 2> /dev/null | cmp -s - "$WORK/pipe.bin"; then
+        pass "gzip_encoder output survives splice in the next process"
+    else
+        fail "gzip_encoder output is corrupted by splice in the next process"
+    fi
+
+    gzip -c "$WORK/pipe.bin" > "$WORK/pipe.gz"
+    "$WORK/gzip_decoder" -dc "$WORK/pipe.gz" | "$WORK/splicer" | (sleep 2; cat) > "$WORK/pipe.out"
+    if cmp -s "$WORK/pipe.out" "$WORK/pipe.bin"; then
+        pass "gzip_decoder output survives splice in the next process"
+    else
+        fail "gzip_decoder output is corrupted by splice in the next process"
+    fi
+fi
+
+exit $FAILED